@@ -1,11 +1,25 @@
 #include <algorithm>
 #include <bitset>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <optional>
 #include <random>
+#include <string>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#include "arena.h"
+#include "command-buffer.h"
+#include "cpu-dispatch.h"
+#include "memory-stats.h"
 #include "pcg_random.hpp"
+#include "snapshot.h"
+#include "sparse-set.h"
+#include "spatial-grid.h"
+#include "thread-pool.h"
 
 // A lot of this library is just done the way it is for simplicity.
 // That is the reason for one header file and systems just built into the
@@ -27,6 +41,40 @@ struct ToDraw {
   float y;
 };
 
+// Controls which entities the graphics system skips instead of emitting.
+// The screen size is only used to map positions and radii to pixels the same
+// way the host does when drawing. A width or height of 0 disables bounds
+// culling.
+struct CullSettings {
+  int32_t width = 0;
+  int32_t height = 0;
+  // An alpha of 0 never changes a pixel, so skipping it is free.
+  uint8_t min_alpha = 1;
+  float min_radius = 0.0f;
+};
+
+// Counts of entities skipped by the graphics system in the last frame.
+struct CullStats {
+  int32_t offscreen = 0;
+  int32_t faded = 0;
+  int32_t too_small = 0;
+
+  int32_t total() const { return offscreen + faded + too_small; }
+};
+
+// True if drawing this would not touch a single pixel on screen.
+inline bool IsOffscreen(const CullSettings& settings, const ToDraw& to_draw) {
+  if (settings.width == 0 || settings.height == 0) return false;
+  int center_x = std::round(to_draw.x * settings.width);
+  int center_y = std::round((1.0 - to_draw.y) * settings.height);
+  int radius = std::max(
+      static_cast<int>(std::round(to_draw.radius *
+                                  (settings.height + settings.width) / 2.0)),
+      1);
+  return center_x + radius <= 0 || center_x - radius >= settings.width ||
+         center_y + radius <= 0 || center_y - radius >= settings.height;
+}
+
 struct CompDeathTime {
   int32_t dead_frame;
 };
@@ -61,6 +109,60 @@ struct CompVelocity {
   float dy;
 };
 
+// A firework that died this frame. Explosions run sorted by this order so the
+// rng is drawn from in the same order no matter how entities are stored.
+struct Explosion {
+  CompPosition position;
+  Color color;
+  int32_t num_particles;
+
+  friend bool operator<(const Explosion& lhs, const Explosion& rhs) {
+    auto key = [](const Explosion& e) {
+      return std::make_tuple(e.position.x, e.position.y, e.color.r, e.color.g,
+                             e.color.b, e.color.a, e.num_particles);
+    };
+    return key(lhs) < key(rhs);
+  }
+};
+
+// Entities a system asks for in a command buffer. They are made when the
+// buffer is played back, since that is where the rng is drawn from, so one
+// record stands for a whole explosion or a frame's fireworks.
+struct NewEntities {
+  enum class Kind : uint8_t {
+    EXPLOSION,
+    FIREWORKS,
+  };
+
+  Kind kind;
+  // For EXPLOSION.
+  Explosion explosion;
+  // For FIREWORKS, as passed to Step.
+  float spawn_rate;
+  int32_t explosion_particles;
+};
+
+// The state of a single live entity in a form that is the same for every ECS.
+// Bit i of components is set for each component present, in the order the
+// fields are listed. Missing components are left zeroed.
+struct EntityState {
+  uint32_t components = 0;
+  CompDeathTime death_time = {};
+  CompFades fades = {};
+  CompExplodes explodes = {};
+  CompGraphics graphics = {};
+  CompPosition position = {};
+  CompVelocity velocity = {};
+};
+
+// Notified around every system that Step runs, e.g. to hash or profile them.
+class SystemObserver {
+ public:
+  virtual ~SystemObserver() = default;
+  virtual void BeforeSystem(const char* /*system*/) {}
+  virtual void AfterSystem(const char* /*system*/) {}
+};
+
 class Signiture {
  public:
   static constexpr int32_t DEATH_TIME_INDEX = 0;
@@ -106,12 +208,125 @@ class Signiture {
     return lhs.data_ == rhs.data_;
   }
 
+  static Signiture FromBits(uint32_t bits) {
+    Signiture sig;
+    sig.data_ = std::bitset<COUNT>(bits);
+    return sig;
+  }
+
+  uint32_t bits() const { return data_.to_ulong(); }
+
+  // Components kept in a sparse set by entity id instead of in architype
+  // columns. Tags have no data, so giving each combination of them its own
+  // architype only splits chunks and makes adding or removing one a copy.
+  static constexpr uint32_t SPARSE_BITS = 1u << FEELS_GRAVITY_INDEX;
+
+  static bool IsSparse(int32_t index) { return SPARSE_BITS >> index & 1; }
+
+  // The part of the signiture that picks an architype.
+  Signiture Dense() const { return FromBits(bits() & ~SPARSE_BITS); }
+
  private:
   std::bitset<COUNT> data_;
 };
 
+// Hands out fixed size blocks of memory for architype chunks.
+// Freed chunks are kept for reuse and all memory goes back to the PageArena
+// with the pool.
+class ChunkPool {
+ public:
+  // Sized so a chunk's columns fit comfortably in L1 or L2.
+  static constexpr int32_t CHUNK_SIZE = 16 * 1024;
+
+  // Chunks come from the arena a huge page worth at a time so consecutive
+  // chunks are usually next to each other in memory.
+  static constexpr size_t SLAB_SIZE = PageArena::HUGE_PAGE_SIZE;
+
+  ChunkPool() = default;
+  ChunkPool(const ChunkPool&) = delete;
+  ChunkPool& operator=(const ChunkPool&) = delete;
+
+  ~ChunkPool() {
+    for (uint8_t* slab : slabs_) PageArena::Default().Free(slab, SLAB_SIZE);
+  }
+
+  uint8_t* Allocate() {
+    if (free_.empty()) {
+      uint8_t* slab =
+          static_cast<uint8_t*>(PageArena::Default().Allocate(SLAB_SIZE));
+      slabs_.push_back(slab);
+      // Handed out from the front of the slab first.
+      for (size_t offset = SLAB_SIZE; offset >= CHUNK_SIZE;
+           offset -= CHUNK_SIZE) {
+        free_.push_back(slab + offset - CHUNK_SIZE);
+      }
+    }
+    uint8_t* data = free_.back();
+    free_.pop_back();
+    return data;
+  }
+
+  void Free(uint8_t* data) { free_.push_back(data); }
+
+  // Gives every slab whose chunks are all free back to the arena and
+  // returns the bytes given back.
+  size_t ReleaseFreeSlabs() {
+    constexpr size_t CHUNKS_PER_SLAB = SLAB_SIZE / CHUNK_SIZE;
+    std::sort(slabs_.begin(), slabs_.end());
+    std::vector<size_t> free_chunks(slabs_.size(), 0);
+    auto slab_of = [&](uint8_t* chunk) {
+      return std::upper_bound(slabs_.begin(), slabs_.end(), chunk) -
+             slabs_.begin() - 1;
+    };
+    for (uint8_t* chunk : free_) ++free_chunks[slab_of(chunk)];
+    auto released = [&](uint8_t* chunk) {
+      return free_chunks[slab_of(chunk)] == CHUNKS_PER_SLAB;
+    };
+    // The chunks left keep their order.
+    free_.erase(std::remove_if(free_.begin(), free_.end(), released),
+                free_.end());
+    std::vector<uint8_t*> kept;
+    for (size_t s = 0; s < slabs_.size(); ++s) {
+      if (free_chunks[s] == CHUNKS_PER_SLAB) {
+        PageArena::Default().Free(slabs_[s], SLAB_SIZE);
+      } else {
+        kept.push_back(slabs_[s]);
+      }
+    }
+    const size_t bytes = (slabs_.size() - kept.size()) * SLAB_SIZE;
+    slabs_.swap(kept);
+    free_.shrink_to_fit();
+    return bytes;
+  }
+
+  const std::vector<uint8_t*>& slabs() const { return slabs_; }
+  int32_t free_chunks() const { return free_.size(); }
+
+ private:
+  std::vector<uint8_t*> slabs_;
+  std::vector<uint8_t*> free_;
+};
+
+// One pool sized block holding a column for each component of an architype.
+// Unused columns are nullptr.
+struct Chunk {
+  uint8_t* data;
+  int32_t size = 0;
+
+  // Every architype has ids. They stay with an entity when it moves, so
+  // sparse sets can refer to it.
+  int32_t* ids = nullptr;
+  CompDeathTime* death_time = nullptr;
+  CompFades* fades = nullptr;
+  CompExplodes* explodes = nullptr;
+  CompGraphics* graphics = nullptr;
+  CompPosition* position = nullptr;
+  CompVelocity* velocity = nullptr;
+};
+
 struct KilledEntity {
   const Signiture signiture;
+  int32_t id;
   std::optional<CompDeathTime> death_time;
   std::optional<CompFades> fades;
   std::optional<CompExplodes> explodes;
@@ -124,140 +339,558 @@ struct KilledEntity {
 
 // This ECS is sorted into architypes.
 // Essentially entities with the same signiture are grouped together.
+// They are stored in chunks from the pool, so growing never copies entities.
+// Every chunk but the last is full, so entities are removed by moving the
+// architype's last entity into their place.
 struct Architype {
-  Architype(Signiture sig, int32_t cap) : signiture(sig) {
-    auto reserve = [&](int sig_index, auto& vec) {
-      if (signiture[sig_index]) {
-        vec.reserve(cap);
-      }
-    };
-    reserve(Signiture::DEATH_TIME_INDEX, death_time);
-    reserve(Signiture::FADES_INDEX, fades);
-    reserve(Signiture::EXPLODES_INDEX, explodes);
-    reserve(Signiture::GRAPHICS_INDEX, graphics);
-    reserve(Signiture::POSITION_INDEX, position);
-    reserve(Signiture::VELOCITY_INDEX, velocity);
+  Architype(Signiture sig, ChunkPool& pool) : signiture(sig), pool(pool) {
+    // Each column starts on a cache line.
+    constexpr int32_t ALIGN = 64;
+    Chunk layout{.data = nullptr};
+    int32_t columns = 0;
+    forEachColumn(layout, [&](auto*& column) {
+      ++columns;
+      entity_bytes += sizeof(*column);
+    });
+    capacity = entity_bytes == 0
+                   ? ChunkPool::CHUNK_SIZE
+                   : (ChunkPool::CHUNK_SIZE - ALIGN * columns) / entity_bytes;
+    int32_t offset = 0;
+    forEachColumn(layout, [&](auto*& column) {
+      column_offsets.push_back(offset);
+      int32_t end = offset + sizeof(*column) * capacity;
+      offset = (end + ALIGN - 1) / ALIGN * ALIGN;
+    });
   }
 
-  void addEntity(std::optional<CompDeathTime> dt, std::optional<CompFades> f,
+  void addEntity(int32_t id, std::optional<CompDeathTime> dt,
+                 std::optional<CompFades> f,
                  std::optional<CompExplodes> e, std::optional<CompGraphics> g,
                  std::optional<CompPosition> p, std::optional<CompVelocity> v) {
-    if (dt) death_time.push_back(*dt);
-    if (f) fades.push_back(*f);
-    if (e) explodes.push_back(*e);
-    if (g) graphics.push_back(*g);
-    if (p) position.push_back(*p);
-    if (v) velocity.push_back(*v);
+    if (chunks.empty() || chunks.back().size == capacity) {
+      chunks.push_back(newChunk());
+    }
+    Chunk& chunk = chunks.back();
+    int32_t i = chunk.size;
+    chunk.ids[i] = id;
+    if (dt) chunk.death_time[i] = *dt;
+    if (f) chunk.fades[i] = *f;
+    if (e) chunk.explodes[i] = *e;
+    if (g) chunk.graphics[i] = *g;
+    if (p) chunk.position[i] = *p;
+    if (v) chunk.velocity[i] = *v;
+    ++chunk.size;
     ++size;
   }
 
-  KilledEntity removeEntity(int i) {
-    KilledEntity e{.signiture = signiture};
-    auto swap_and_remove = [&](int sig_index, auto& vec, auto& data) {
-      if (signiture[sig_index]) {
-        std::iter_swap(vec.begin() + i, vec.end() - 1);
-        data = vec.back();
-        vec.pop_back();
+  KilledEntity removeEntity(int32_t chunk_index, int32_t i) {
+    Chunk& chunk = chunks[chunk_index];
+    Chunk& last = chunks.back();
+    int32_t last_i = last.size - 1;
+    KilledEntity e{.signiture = signiture, .id = chunk.ids[i]};
+    chunk.ids[i] = last.ids[last_i];
+    auto swap_and_remove = [&](auto* column, auto* last_column, auto& data) {
+      if (column != nullptr) {
+        data = column[i];
+        column[i] = last_column[last_i];
       }
     };
-    swap_and_remove(Signiture::DEATH_TIME_INDEX, death_time, e.death_time);
-    swap_and_remove(Signiture::FADES_INDEX, fades, e.fades);
-    swap_and_remove(Signiture::EXPLODES_INDEX, explodes, e.explodes);
-    swap_and_remove(Signiture::GRAPHICS_INDEX, graphics, e.graphics);
-    swap_and_remove(Signiture::POSITION_INDEX, position, e.position);
-    swap_and_remove(Signiture::VELOCITY_INDEX, velocity, e.velocity);
+    swap_and_remove(chunk.death_time, last.death_time, e.death_time);
+    swap_and_remove(chunk.fades, last.fades, e.fades);
+    swap_and_remove(chunk.explodes, last.explodes, e.explodes);
+    swap_and_remove(chunk.graphics, last.graphics, e.graphics);
+    swap_and_remove(chunk.position, last.position, e.position);
+    swap_and_remove(chunk.velocity, last.velocity, e.velocity);
+    --last.size;
     --size;
+    if (last.size == 0) {
+      pool.Free(last.data);
+      chunks.pop_back();
+    }
     return e;
   }
 
+  // Adds an empty chunk for size entities that the caller fills in.
+  Chunk& addChunk(int32_t chunk_size) {
+    chunks.push_back(newChunk());
+    chunks.back().size = chunk_size;
+    size += chunk_size;
+    return chunks.back();
+  }
+
+  // Gives every chunk back to the pool.
+  void clear() {
+    for (Chunk& chunk : chunks) pool.Free(chunk.data);
+    chunks.clear();
+    size = 0;
+    feels_gravity = 0;
+  }
+
+  // Copies the rows chunk uses into out, a zeroed chunk sized buffer, at
+  // the offsets they have in chunk.
+  void copyRows(Chunk chunk, uint8_t* out) const {
+    forEachColumn(chunk, [&](auto*& column) {
+      const size_t offset = reinterpret_cast<uint8_t*>(column) - chunk.data;
+      std::memcpy(out + offset, column, chunk.size * sizeof(*column));
+    });
+  }
+
   bool Matches(Signiture other) const { return signiture.Matches(other); }
 
   const Signiture signiture;
   int32_t size = 0;
+  // Entities per chunk.
+  int32_t capacity;
+  // Bytes per entity, its id included.
+  int32_t entity_bytes = 0;
+  // Entities here that are in the gravity set, so queries can skip the set
+  // when it holds all of them or none.
+  int32_t feels_gravity = 0;
+  std::vector<Chunk> chunks;
+
+ private:
+  // Calls f with each of the chunk's column pointers that this architype
+  // uses, always in the same order.
+  template <typename F>
+  void forEachColumn(Chunk& chunk, F f) const {
+    f(chunk.ids);
+    auto column = [&](int32_t sig_index, auto*& member) {
+      if (signiture[sig_index]) f(member);
+    };
+    column(Signiture::DEATH_TIME_INDEX, chunk.death_time);
+    column(Signiture::FADES_INDEX, chunk.fades);
+    column(Signiture::EXPLODES_INDEX, chunk.explodes);
+    column(Signiture::GRAPHICS_INDEX, chunk.graphics);
+    column(Signiture::POSITION_INDEX, chunk.position);
+    column(Signiture::VELOCITY_INDEX, chunk.velocity);
+  }
 
-  // Unused vectors will remain empty.
-  std::vector<CompDeathTime> death_time;
-  std::vector<CompFades> fades;
-  std::vector<CompExplodes> explodes;
-  std::vector<CompGraphics> graphics;
-  std::vector<CompPosition> position;
-  std::vector<CompVelocity> velocity;
+  Chunk newChunk() {
+    Chunk chunk{.data = pool.Allocate()};
+    size_t i = 0;
+    forEachColumn(chunk, [&](auto*& column) {
+      using Column = std::remove_reference_t<decltype(column)>;
+      column = reinterpret_cast<Column>(chunk.data + column_offsets[i++]);
+    });
+    return chunk;
+  }
+
+  ChunkPool& pool;
+  std::vector<int32_t> column_offsets;
 };
 
 struct Entity {
-  Architype& architype;
+  Chunk& chunk;
   int32_t id;
 };
 
+// Where an entity is stored, for commands that refer to it before playback.
+struct EntitySlot {
+  int32_t architype;
+  int32_t chunk;
+  int32_t index;
+
+  friend bool operator<(const EntitySlot& lhs, const EntitySlot& rhs) {
+    return std::tie(lhs.architype, lhs.chunk, lhs.index) <
+           std::tie(rhs.architype, rhs.chunk, rhs.index);
+  }
+};
+
 class ECS {
- public:
-  static constexpr int32_t DEFAULT_CAP = 128;
+  // The system benchmarks build worlds and run single systems directly.
+  friend class SystemBench;
 
+ public:
   explicit ECS(int32_t max)
-      : max_(max), rng_(pcg_extras::seed_seq_from<std::random_device>()) {}
+      : size_(0),
+        max_(max),
+        rng_(pcg_extras::seed_seq_from<std::random_device>()) {}
+
+  // A fixed seed makes every run with the same inputs identical.
+  ECS(int32_t max, uint64_t seed) : size_(0), max_(max), rng_(seed) {}
+
+  // Worlds with the same seed and different streams draw unrelated numbers.
+  ECS(int32_t max, uint64_t seed, uint64_t stream)
+      : size_(0), max_(max), rng_(seed, stream) {}
 
   // This will clear all current entities.
   void SetMaxEntities(int32_t max) {
     max_ = max;
     size_ = 0;
+    for (auto& architype : architypes_) architype.clear();
     architypes_.clear();
+    free_ids_.clear();
+    next_id_ = 0;
+    feels_gravity_.Clear();
   }
 
   // Runs systems that only modify a single entity at a time.
   // They can not change the components the entity has.
-  inline void RunSimpleSystem(Signiture signiture,
-                              std::function<void(Entity)> f) {
-    for (auto& architype : architypes_) {
-      if (architype.Matches(signiture)) {
-        for (int32_t i = 0; i < architype.size; ++i) {
-          f({architype, i});
+  // The loop and f are compiled once per instruction set, so the chunk loops
+  // vectorize as wide as the host allows. A sparse component in the
+  // signiture is only checked per entity in architypes where some but not
+  // all entities have it.
+  template <typename F>
+  void RunSimpleSystem(Signiture signiture, F f) {
+    const Signiture dense = signiture.Dense();
+    const bool gravity = signiture[Signiture::FEELS_GRAVITY_INDEX];
+    dispatch_kernel([&](auto) {
+      for (auto& architype : architypes_) {
+        if (!architype.Matches(dense)) continue;
+        const bool check =
+            gravity && architype.feels_gravity != architype.size;
+        if (check && architype.feels_gravity == 0) continue;
+        for (Chunk& chunk : architype.chunks) {
+          if (!check) {
+            for (int32_t i = 0; i < chunk.size; ++i) {
+              f({chunk, i});
+            }
+            continue;
+          }
+          for (int32_t i = 0; i < chunk.size; ++i) {
+            if (feels_gravity_.Contains(chunk.ids[i])) f({chunk, i});
+          }
         }
       }
-    }
+    });
   }
 
+  // Graphics is skipped and nothing is returned unless draw is set.
   std::vector<ToDraw> Step(int32_t current_frame, float spawn_rate,
-                           int32_t explosion_particles) {
-    RunDeathSystem(current_frame);
-    RunExplodesSystem(current_frame);
-    RunFadeSystem();
-    RunMoveSystem();
-    RunGravitySystem();
-    RunSpawnSystem(current_frame, spawn_rate, explosion_particles);
-    return RunGraphicsSystem();
+                           int32_t explosion_particles, bool draw = true) {
+    Observe("Death", [&] { RunDeathSystem(current_frame); });
+    Observe("Explodes", [&] { RunExplodesSystem(current_frame); });
+    Observe("Fade", [&] { RunFadeSystem(); });
+    Observe("Move", [&] { RunMoveSystem(); });
+    Observe("Gravity", [&] { RunGravitySystem(); });
+    if (collisions_) Observe("Collision", [&] { RunCollisionSystem(); });
+    Observe("Spawn", [&] {
+      RunSpawnSystem(current_frame, spawn_rate, explosion_particles);
+    });
+    std::vector<ToDraw> out;
+    if (draw) Observe("Graphics", [&] { out = RunGraphicsSystem(); });
+    return out;
   }
 
   int32_t size() const { return size_; }
 
+  // The observer must outlive the ECS or be reset to nullptr.
+  void SetSystemObserver(SystemObserver* observer) { observer_ = observer; }
+
+  // Calls f with the EntityState of every live entity in no particular order.
+  template <typename F>
+  void ForEachLiveEntity(F f) const {
+    for (const auto& architype : architypes_) {
+      const Signiture& sig = architype.signiture;
+      for (const Chunk& chunk : architype.chunks) {
+        for (int32_t i = 0; i < chunk.size; ++i) {
+          EntityState state;
+          auto copy = [&](int32_t sig_index, auto& field, const auto* column) {
+            if (sig[sig_index]) {
+              state.components |= 1u << sig_index;
+              field = column[i];
+            }
+          };
+          copy(Signiture::DEATH_TIME_INDEX, state.death_time,
+               chunk.death_time);
+          copy(Signiture::FADES_INDEX, state.fades, chunk.fades);
+          copy(Signiture::EXPLODES_INDEX, state.explodes, chunk.explodes);
+          copy(Signiture::GRAPHICS_INDEX, state.graphics, chunk.graphics);
+          copy(Signiture::POSITION_INDEX, state.position, chunk.position);
+          copy(Signiture::VELOCITY_INDEX, state.velocity, chunk.velocity);
+          if (feels_gravity_.Contains(chunk.ids[i])) {
+            state.components |= 1u << Signiture::FEELS_GRAVITY_INDEX;
+          }
+          f(state);
+        }
+      }
+    }
+  }
+
+  void SetCullSettings(CullSettings settings) { cull_ = settings; }
+  const CullStats& cull_stats() const { return cull_stats_; }
+
+  int32_t max_entities() const { return max_; }
+
+  // Caps how many entities spawns and explosions may create, below
+  // max_entities, without clearing anything. Entities over the budget
+  // live out their lives; it only stops new ones.
+  void SetEntityBudget(int32_t budget) { entity_budget_ = budget; }
+  int32_t entity_budget() const { return EntityCap(); }
+
+  // Storage grows a chunk at a time per architype, so this shows how full
+  // each architype's chunks are, how much of that is each component and
+  // how many chunks sit free in the pool. Call between frames.
+  MemoryStats GetMemoryStats() const {
+    MemoryStats stats;
+    stats.live = size_;
+    stats.capacity = max_;
+    for (const Architype& architype : architypes_) {
+      const int64_t chunks = architype.chunks.size();
+      stats.Add(stats.architypes,
+                {.name = ArchitypeName(architype.signiture),
+                 .live = architype.size,
+                 .capacity = chunks * architype.capacity,
+                 .reserved_bytes = size_t(chunks) * ChunkPool::CHUNK_SIZE,
+                 .used_bytes = size_t(architype.size) *
+                               architype.entity_bytes});
+    }
+    stats.Add(stats.architypes,
+              {.name = "(free chunks)",
+               .reserved_bytes = size_t(chunk_pool_.free_chunks()) *
+                                 ChunkPool::CHUNK_SIZE});
+    stats.Add(stats.architypes,
+              {.name = "(gravity set)",
+               .live = feels_gravity_.size(),
+               .reserved_bytes = feels_gravity_.reserved_bytes(),
+               .used_bytes = feels_gravity_.size() * sizeof(int32_t)});
+    stats.Add(stats.architypes,
+              {.name = "(free ids)",
+               .reserved_bytes = free_ids_.capacity() * sizeof(int32_t),
+               .used_bytes = free_ids_.size() * sizeof(int32_t)});
+    // A breakdown of the same chunks, so not added to the totals again.
+    auto component = [&](const char* name, int32_t index, size_t bytes) {
+      MemoryUsage usage = {.name = name};
+      for (const Architype& architype : architypes_) {
+        if (!architype.signiture[index]) continue;
+        usage.live += architype.size;
+        usage.capacity += int64_t(architype.chunks.size()) * architype.capacity;
+      }
+      usage.reserved_bytes = usage.capacity * bytes;
+      usage.used_bytes = usage.live * bytes;
+      stats.components.push_back(usage);
+    };
+    component("death_time", Signiture::DEATH_TIME_INDEX, sizeof(CompDeathTime));
+    component("fades", Signiture::FADES_INDEX, sizeof(CompFades));
+    component("explodes", Signiture::EXPLODES_INDEX, sizeof(CompExplodes));
+    component("graphics", Signiture::GRAPHICS_INDEX, sizeof(CompGraphics));
+    component("position", Signiture::POSITION_INDEX, sizeof(CompPosition));
+    component("velocity", Signiture::VELOCITY_INDEX, sizeof(CompVelocity));
+    for (uint8_t* slab : chunk_pool_.slabs()) {
+      stats.resident_bytes +=
+          PageArena::ResidentBytes(slab, ChunkPool::SLAB_SIZE);
+    }
+    stats.SetArena(PageArena::Default());
+    return stats;
+  }
+
+  // Gives back memory the world isn't using: slabs of the chunk pool with
+  // no chunk in use, the chunk lists of architypes that have shrunk, scratch
+  // space for systems that are off and blocks the PageArena kept for reuse.
+  // Empty architypes stay so the order systems visit entities in doesn't
+  // change. Returns the bytes given back. Call between frames.
+  size_t ReleaseUnusedMemory() {
+    size_t released = chunk_pool_.ReleaseFreeSlabs();
+    for (Architype& architype : architypes_) architype.chunks.shrink_to_fit();
+    auto free_vector = [](auto& vector) {
+      vector.clear();
+      vector.shrink_to_fit();
+    };
+    free_vector(explosions_);
+    free_vector(fireworks_);
+    free_vector(changes_);
+    free_vector(destroys_);
+    free_vector(death_chunks_);
+    free_vector(newly_dead_entities);
+    if (!collisions_) {
+      free_vector(collision_bodies_);
+      free_vector(collision_entities_);
+      collision_grid_ = SpatialGrid<CollisionBody>(2 * COLLISION_RADIUS);
+    }
+    return released + PageArena::Default().ReleaseFree();
+  }
+
+  // With collisions explosion particles bounce off the bottom of the screen
+  // and off each other.
+  void SetCollisions(bool enabled) { collisions_ = enabled; }
+  bool collisions() const { return collisions_; }
+
+  // Writes the whole world to a snapshot, between frames. frame is the last
+  // frame stepped. Chunks keep their layout, so loading one is a single copy,
+  // but only the rows in use are written and the rest is zero.
+  bool Save(const std::string& path, int32_t frame) const {
+    std::vector<SavedArchitype> architypes;
+    std::vector<int32_t> chunk_sizes;
+    std::vector<uint8_t> chunks;
+    for (const Architype& architype : architypes_) {
+      architypes.push_back(
+          {.signiture = architype.signiture.bits(),
+           .chunks = static_cast<int32_t>(architype.chunks.size())});
+      for (const Chunk& chunk : architype.chunks) {
+        chunk_sizes.push_back(chunk.size);
+        chunks.resize(chunks.size() + ChunkPool::CHUNK_SIZE);
+        architype.copyRows(chunk, chunks.data() + chunks.size() -
+                                      ChunkPool::CHUNK_SIZE);
+      }
+    }
+    SnapshotWriter writer(SNAPSHOT_NAME, frame);
+    writer.AddValue("max", max_);
+    writer.AddValue("size", size_);
+    writer.AddVector("architypes", architypes);
+    writer.AddVector("chunk_sizes", chunk_sizes);
+    writer.AddVector("chunks", chunks);
+    writer.AddValue("next_id", next_id_);
+    writer.AddVector("free_ids", free_ids_);
+    writer.AddVector("feels_gravity", feels_gravity_.members());
+    writer.AddStreamed("rng", rng_);
+    return writer.Write(path);
+  }
+
+  // Replaces the world with a snapshot from Save and sets frame to the frame
+  // it was saved after. On failure the world is left empty with its old cap.
+  bool Load(const std::string& path, int32_t& frame) {
+    const int32_t previous_max = max_;
+    SnapshotReader reader;
+    int32_t max;
+    if (!reader.Open(path) || reader.ecs() != SNAPSHOT_NAME ||
+        !reader.ReadValue("max", max) || max < 0) {
+      SetMaxEntities(previous_max);
+      return false;
+    }
+    SetMaxEntities(max);
+    std::vector<SavedArchitype> architypes;
+    std::vector<int32_t> chunk_sizes;
+    std::vector<int32_t> feels_gravity;
+    size_t chunk_bytes = 0;
+    const uint8_t* chunks = reader.Find("chunks", chunk_bytes);
+    bool ok = reader.ReadValue("size", size_) &&
+              reader.ReadResized("architypes", architypes) &&
+              reader.ReadResized("chunk_sizes", chunk_sizes) &&
+              reader.ReadValue("next_id", next_id_) &&
+              reader.ReadResized("free_ids", free_ids_) &&
+              reader.ReadResized("feels_gravity", feels_gravity) &&
+              reader.ReadStreamed("rng", rng_) && chunks != nullptr &&
+              chunk_bytes == chunk_sizes.size() * ChunkPool::CHUNK_SIZE &&
+              0 <= next_id_ && next_id_ <= max_;
+    // Every id below next_id_ is either in a chunk or free, exactly once.
+    std::vector<bool> seen(ok ? next_id_ : 0);
+    auto see = [&](int32_t id) {
+      if (id < 0 || id >= next_id_ || seen[id]) return false;
+      seen[id] = true;
+      return true;
+    };
+    for (int32_t id : free_ids_) ok = ok && see(id);
+    int64_t live = 0;
+    for (int32_t chunk_size : chunk_sizes) live += chunk_size;
+    ok = ok && live == size_ && live + int64_t(free_ids_.size()) == next_id_;
+    for (int32_t id : feels_gravity) {
+      ok = ok && id >= 0 && id < next_id_;
+      if (ok) feels_gravity_.Insert(id);
+    }
+    size_t next_chunk = 0;
+    for (size_t a = 0; ok && a < architypes.size(); ++a) {
+      Architype& architype = architypes_.emplace_back(
+          Signiture::FromBits(architypes[a].signiture), chunk_pool_);
+      for (int32_t c = 0; ok && c < architypes[a].chunks; ++c) {
+        ok = next_chunk < chunk_sizes.size() &&
+             chunk_sizes[next_chunk] > 0 &&
+             chunk_sizes[next_chunk] <= architype.capacity;
+        if (!ok) break;
+        Chunk& chunk = architype.addChunk(chunk_sizes[next_chunk]);
+        std::memcpy(chunk.data, chunks + next_chunk * ChunkPool::CHUNK_SIZE,
+                    ChunkPool::CHUNK_SIZE);
+        for (int32_t i = 0; ok && i < chunk.size; ++i) {
+          ok = see(chunk.ids[i]);
+          if (ok && feels_gravity_.Contains(chunk.ids[i])) {
+            ++architype.feels_gravity;
+          }
+        }
+        ++next_chunk;
+      }
+    }
+    if (!ok || next_chunk != chunk_sizes.size()) {
+      SetMaxEntities(previous_max);
+      return false;
+    }
+    frame = reader.frame();
+    return true;
+  }
+
  private:
-  inline bool CanAddEntity() const { return size_ < max_; }
+  using Commands = CommandBuffers<EntitySlot, EntityState, NewEntities>;
 
+  template <typename F>
+  void Observe(const char* system, F run) {
+    if (observer_ == nullptr) {
+      run();
+      return;
+    }
+    observer_->BeforeSystem(system);
+    run();
+    observer_->AfterSystem(system);
+  }
+
+  // Moving an entity between architypes removes and re-adds it, so only new
+  // entities are held to the budget and AddEntity itself checks max_.
+  inline bool CanAddEntity() const { return size_ < EntityCap(); }
+
+  // Adds a new entity, putting it in the sets of the sparse components in
+  // its signiture. Moving an entity passes the id it already has and its
+  // sparse components stay as they are.
   inline void AddEntity(Signiture signiture,
                         std::optional<CompDeathTime> death_time,
                         std::optional<CompFades> fades,
                         std::optional<CompExplodes> explodes,
                         std::optional<CompGraphics> graphics,
                         std::optional<CompPosition> position,
-                        std::optional<CompVelocity> velocity) {
+                        std::optional<CompVelocity> velocity,
+                        std::optional<int32_t> id = std::nullopt) {
     if (size_ < max_) {
       ++size_;
-      auto iter = std::find_if(architypes_.begin(), architypes_.end(),
-                               [signiture](const Architype& at) {
-                                 return at.signiture == signiture;
-                               });
-      if (iter == architypes_.end()) {
-        architypes_.emplace_back(signiture, DEFAULT_CAP);
-        architypes_.back().addEntity(death_time, fades, explodes, graphics,
-                                     position, velocity);
-      } else {
-        iter->addEntity(death_time, fades, explodes, graphics, position,
-                        velocity);
+      if (!id) {
+        id = NewId();
+        if (signiture[Signiture::FEELS_GRAVITY_INDEX]) {
+          feels_gravity_.Insert(*id);
+        }
       }
+      const Signiture dense = signiture.Dense();
+      auto iter = std::find_if(
+          architypes_.begin(), architypes_.end(),
+          [dense](const Architype& at) { return at.signiture == dense; });
+      Architype& architype = iter == architypes_.end()
+                                 ? architypes_.emplace_back(dense, chunk_pool_)
+                                 : *iter;
+      architype.addEntity(*id, death_time, fades, explodes, graphics,
+                          position, velocity);
+      if (feels_gravity_.Contains(*id)) ++architype.feels_gravity;
     }
   }
 
+  // Removes the entity without freeing its id, which is up to the caller.
+  KilledEntity RemoveEntity(Architype& architype, int32_t chunk, int32_t i) {
+    KilledEntity e = architype.removeEntity(chunk, i);
+    if (feels_gravity_.Contains(e.id)) --architype.feels_gravity;
+    --size_;
+    return e;
+  }
+
+  // Ids of destroyed entities are reused, so they stay below max_.
+  int32_t NewId() {
+    if (free_ids_.empty()) return next_id_++;
+    const int32_t id = free_ids_.back();
+    free_ids_.pop_back();
+    return id;
+  }
+
+  // Called once an entity is destroyed, not when it moves.
+  void FreeId(int32_t id) {
+    feels_gravity_.Erase(id);
+    free_ids_.push_back(id);
+  }
+
+  // A frame's fireworks are one record, since they all draw from the rng.
   void RunSpawnSystem(int32_t current_frame, float spawn_rate,
                       int32_t explosion_particles) {
+    commands_.Reset(1);
+    commands_[0].Create({.kind = NewEntities::Kind::FIREWORKS,
+                         .explosion = {},
+                         .spawn_rate = spawn_rate,
+                         .explosion_particles = explosion_particles});
+    PlayBackCommands(current_frame);
+  }
+
+  void AddFireworks(int32_t current_frame, float spawn_rate,
+                    int32_t explosion_particles) {
     const Signiture spawn_signiture({.hasDeathTime = true,
                                      .hasExplodes = true,
                                      .hasGraphics = true,
@@ -303,109 +936,315 @@ class ECS {
     }
   }
 
+  // Each block checks a run of chunks and records the dead entities in
+  // them. Playback removes them into newly_dead_entities.
   void RunDeathSystem(int32_t current_frame) {
+    constexpr int32_t CHUNKS_PER_BLOCK = 32;
     const Signiture death_signiture({.hasDeathTime = true});
-
-    newly_dead_entities.clear();
-    for (auto& architype : architypes_) {
-      if (architype.Matches(death_signiture)) {
-        for (int32_t i = 0; i < architype.size; ++i) {
-          if (current_frame >= architype.death_time[i].dead_frame) {
-            newly_dead_entities.push_back(architype.removeEntity(i));
-            --i;
-            --size_;
+    death_chunks_.clear();
+    for (size_t a = 0; a < architypes_.size(); ++a) {
+      if (!architypes_[a].Matches(death_signiture)) continue;
+      for (size_t c = 0; c < architypes_[a].chunks.size(); ++c) {
+        death_chunks_.push_back({.architype = static_cast<int32_t>(a),
+                                 .chunk = static_cast<int32_t>(c),
+                                 .index = 0});
+      }
+    }
+    const int32_t chunks = death_chunks_.size();
+    const int32_t blocks = (chunks + CHUNKS_PER_BLOCK - 1) / CHUNKS_PER_BLOCK;
+    commands_.Reset(blocks);
+    pool_->Run(blocks, [&](int32_t b) {
+      const int32_t end = std::min(chunks, (b + 1) * CHUNKS_PER_BLOCK);
+      for (int32_t k = b * CHUNKS_PER_BLOCK; k < end; ++k) {
+        EntitySlot slot = death_chunks_[k];
+        const Chunk& chunk = architypes_[slot.architype].chunks[slot.chunk];
+        for (slot.index = 0; slot.index < chunk.size; ++slot.index) {
+          if (current_frame >= chunk.death_time[slot.index].dead_frame) {
+            commands_[b].Destroy(slot);
           }
         }
       }
-    }
+    });
+    newly_dead_entities.clear();
+    PlayBackCommands(current_frame);
   }
 
+  // Each block records one create per explosion among the entities Death
+  // removed. Playback sorts them and makes the entities, since the rng has
+  // to be drawn from in explosion order.
   void RunExplodesSystem(int32_t current_frame) {
+    constexpr int32_t BLOCK_SIZE = 1 << 14;
     const Signiture explodes_signiture(
         {.hasExplodes = true, .hasGraphics = true, .hasPosition = true});
-    for (const auto& e : newly_dead_entities) {
-      if (e.Matches(explodes_signiture)) {
-        CompPosition position = *e.position;
-        Color color = (*e.graphics).color;
-        if (!CanAddEntity()) return;
-
-        int32_t life_in_frames =
-            std::uniform_int_distribution<int>(10, 30)(rng_);
-        float frame_scale = (10.0f / life_in_frames);
-        CompDeathTime death_time = {.dead_frame =
-                                        current_frame + life_in_frames};
-
-        CompFades fades = {
-            .a_rate = static_cast<uint8_t>(30.0f * frame_scale),
-            .a_min = 50,
-        };
-        if (color.r > color.g && color.r > color.b) {
-          fades.g_min = 100;
-          fades.g_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 0, .g = 255, .r = 255, .a = 255};
-        } else if (color.g > color.b) {
-          fades.b_min = 100;
-          fades.b_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 255, .g = 255, .r = 0, .a = 255};
-        } else {
-          fades.r_min = 100;
-          fades.r_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 255, .g = 0, .r = 255, .a = 255};
-        }
+    const int32_t count = newly_dead_entities.size();
+    const int32_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    commands_.Reset(blocks);
+    pool_->Run(blocks, [&](int32_t b) {
+      const int32_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+      for (int32_t i = b * BLOCK_SIZE; i < end; ++i) {
+        const KilledEntity& e = newly_dead_entities[i];
+        if (!e.Matches(explodes_signiture)) continue;
+        commands_[b].Create(
+            {.kind = NewEntities::Kind::EXPLOSION,
+             .explosion = {.position = *e.position,
+                           .color = (*e.graphics).color,
+                           .num_particles = (*e.explodes).num_particles},
+             .spawn_rate = 0,
+             .explosion_particles = 0});
+      }
+    });
+    PlayBackCommands(current_frame);
+  }
+
+  void AddExplosions(int32_t current_frame) {
+    for (const Explosion& e : explosions_) {
+      CompPosition position = e.position;
+      Color color = e.color;
+      if (FreeSlots() == 0) return;
+
+      int32_t life_in_frames = std::uniform_int_distribution<int>(10, 30)(rng_);
+      float frame_scale = (10.0f / life_in_frames);
+      CompDeathTime death_time = {.dead_frame = current_frame + life_in_frames};
+
+      CompFades fades = {
+          .a_rate = static_cast<uint8_t>(30.0f * frame_scale),
+          .a_min = 50,
+      };
+      if (color.r > color.g && color.r > color.b) {
+        fades.g_min = 100;
+        fades.g_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 0, .g = 255, .r = 255, .a = 255};
+      } else if (color.g > color.b) {
+        fades.b_min = 100;
+        fades.b_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 255, .g = 255, .r = 0, .a = 255};
+      } else {
+        fades.r_min = 100;
+        fades.r_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 255, .g = 0, .r = 255, .a = 255};
+      }
+      CompGraphics graphics = {
+          .color = color,
+          .radius = 0.03f / frame_scale,
+      };
+
+      const Signiture signiture({
+          .hasDeathTime = true,
+          .hasFades = true,
+          .hasGraphics = true,
+          .hasPosition = true,
+      });
+      AddEntity(signiture, death_time, fades, /*explodes=*/std::nullopt,
+                graphics, position, /*velocity=*/std::nullopt);
+
+      int32_t generated_particles = std::min(e.num_particles, FreeSlots());
+      if (generated_particles == 0) return;
+
+      fades.r_rate >>= 2;
+      fades.g_rate >>= 2;
+      fades.b_rate >>= 2;
+      fades.a_rate >>= 1;
+
+      Signiture particle_signiture({
+          .hasDeathTime = true,
+          .hasFades = true,
+          .hasGraphics = true,
+          .hasPosition = true,
+          .hasVelocity = true,
+          .feelsGravity = true,
+      });
+      float chunk_size = (TWO_PI / generated_particles);
+      const float vel_scale = 0.01;
+      for (int i = 0; i < generated_particles; ++i) {
+        float min = i * chunk_size;
+        float max = (i + 1) * chunk_size;
+        float direction = std::uniform_real_distribution<float>(min, max)(rng_);
+        float unit_dx = std::cos(direction);
+        float unit_dy = std::sin(direction);
+
+        CompVelocity velocity = {.dx = unit_dx * vel_scale,
+                                 .dy = unit_dy * vel_scale};
         CompGraphics graphics = {
             .color = color,
-            .radius = 0.03f / frame_scale,
+            .radius = 0.015f / frame_scale,
         };
+        CompDeathTime death_time = {
+            .dead_frame = current_frame +
+                          static_cast<int>(1.5f * life_in_frames) +
+                          std::uniform_int_distribution<int>(0, 10)(rng_)};
+        AddEntity(particle_signiture, death_time, fades,
+                  /*explodes=*/std::nullopt, graphics, position, velocity);
+      }
+    }
+  }
 
-        const Signiture signiture({
-            .hasDeathTime = true,
-            .hasFades = true,
-            .hasGraphics = true,
-            .hasPosition = true,
-        });
-        AddEntity(signiture, death_time, fades, /*explodes=*/std::nullopt,
-                  graphics, position,
-                  /*velocity=*/std::nullopt);
-
-        int32_t generated_particles =
-            std::min((*e.explodes).num_particles, max_ - size_);
-        if (generated_particles == 0) return;
-
-        fades.r_rate >>= 2;
-        fades.g_rate >>= 2;
-        fades.b_rate >>= 2;
-        fades.a_rate >>= 1;
-
-        Signiture particle_signiture({
-            .hasDeathTime = true,
-            .hasFades = true,
-            .hasGraphics = true,
-            .hasPosition = true,
-            .hasVelocity = true,
-            .feelsGravity = true,
+  // Entities that can still be added.
+  int32_t FreeSlots() const { return std::max(0, EntityCap() - size_); }
+
+  int32_t EntityCap() const { return std::min(max_, entity_budget_); }
+
+  // Applies everything recorded in commands_, whose slots are where
+  // entities were when the system ran. Component changes go first, then
+  // destroys and then creates, with explosions made sorted and before
+  // fireworks so the rng is drawn from in the same order as in the simple
+  // ECS.
+  void PlayBackCommands(int32_t current_frame) {
+    destroys_.clear();
+    changes_.clear();
+    explosions_.clear();
+    fireworks_.clear();
+    auto create = [&](const NewEntities& record) {
+      switch (record.kind) {
+        case NewEntities::Kind::EXPLOSION:
+          explosions_.push_back(record.explosion);
+          break;
+        case NewEntities::Kind::FIREWORKS:
+          fireworks_.push_back(record);
+          break;
+      }
+    };
+    commands_.PlayBack(
+        [&](const EntitySlot& slot) { destroys_.push_back(slot); },
+        [&](const Commands::Command& change) { changes_.push_back(change); },
+        create);
+    std::sort(destroys_.begin(), destroys_.end());
+    destroys_.erase(std::unique(destroys_.begin(), destroys_.end(),
+                                [](const EntitySlot& a, const EntitySlot& b) {
+                                  return !(a < b) && !(b < a);
+                                }),
+                    destroys_.end());
+    ApplyChanges();
+    ApplyDestroys();
+    std::sort(explosions_.begin(), explosions_.end());
+    AddExplosions(current_frame);
+    for (const NewEntities& record : fireworks_) {
+      AddFireworks(current_frame, record.spawn_rate,
+                   record.explosion_particles);
+    }
+  }
+
+  // Changing an entity's dense components removes it by moving its
+  // architype's last entity into its place, so entities are changed from the
+  // last stored to the first and this never moves an entity that still has
+  // a change. A destroy of the entity that moves follows it. All the changes
+  // to one entity are merged in the order they were recorded and applied at
+  // once, and changes to an entity that is also destroyed are dropped.
+  // Adding or removing a sparse component only changes its set.
+  void ApplyChanges() {
+    std::stable_sort(
+        changes_.begin(), changes_.end(),
+        [](const Commands::Command& a, const Commands::Command& b) {
+          return b.entity < a.entity;
         });
-        float chunk_size = (TWO_PI / generated_particles);
-        const float vel_scale = 0.01;
-        for (int i = 0; i < generated_particles; ++i) {
-          float min = i * chunk_size;
-          float max = (i + 1) * chunk_size;
-          float direction =
-              std::uniform_real_distribution<float>(min, max)(rng_);
-          float unit_dx = std::cos(direction);
-          float unit_dy = std::sin(direction);
-
-          CompVelocity velocity = {.dx = unit_dx * vel_scale,
-                                   .dy = unit_dy * vel_scale};
-          CompGraphics graphics = {
-              .color = color,
-              .radius = 0.015f / frame_scale,
-          };
-          CompDeathTime death_time = {
-              .dead_frame = current_frame +
-                            static_cast<int>(1.5f * life_in_frames) +
-                            std::uniform_int_distribution<int>(0, 10)(rng_)};
-          AddEntity(particle_signiture, death_time, fades,
-                    /*explodes=*/std::nullopt, graphics, position, velocity);
+    for (size_t c = 0, end = 0; c < changes_.size(); c = end) {
+      const EntitySlot slot = changes_[c].entity;
+      end = c + 1;
+      while (end < changes_.size() && !(changes_[end].entity < slot)) ++end;
+      if (std::binary_search(destroys_.begin(), destroys_.end(), slot)) {
+        continue;
+      }
+
+      const int32_t a = slot.architype;
+      const int32_t id = architypes_[a].chunks[slot.chunk].ids[slot.index];
+      bool gravity = feels_gravity_.Contains(id);
+      Signiture signiture = architypes_[a].signiture;
+      // Dense components given a value, which is the last one added.
+      Signiture added;
+      EntityState values = {};
+      for (size_t k = c; k < end; ++k) {
+        const Commands::Command& change = changes_[k];
+        const bool add = change.op == Commands::Op::ADD_COMPONENT;
+        if (Signiture::IsSparse(change.component)) {
+          gravity = add;
+          continue;
+        }
+        signiture[change.component] = add;
+        added[change.component] = add;
+        if (!add) continue;
+        auto take = [&](int32_t component, auto& field, const auto& value) {
+          if (component == change.component) field = value;
+        };
+        const EntityState& state = change.state;
+        take(Signiture::DEATH_TIME_INDEX, values.death_time, state.death_time);
+        take(Signiture::FADES_INDEX, values.fades, state.fades);
+        take(Signiture::EXPLODES_INDEX, values.explodes, state.explodes);
+        take(Signiture::GRAPHICS_INDEX, values.graphics, state.graphics);
+        take(Signiture::POSITION_INDEX, values.position, state.position);
+        take(Signiture::VELOCITY_INDEX, values.velocity, state.velocity);
+      }
+
+      if (gravity != feels_gravity_.Contains(id)) {
+        if (gravity) {
+          feels_gravity_.Insert(id);
+          ++architypes_[a].feels_gravity;
+        } else {
+          feels_gravity_.Erase(id);
+          --architypes_[a].feels_gravity;
+        }
+      }
+      if (signiture == architypes_[a].signiture && added == Signiture()) {
+        continue;
+      }
+
+      // AddEntity may add an architype, so architype is only used before.
+      Architype& architype = architypes_[a];
+      const EntitySlot last = {
+          .architype = a,
+          .chunk = static_cast<int32_t>(architype.chunks.size()) - 1,
+          .index = architype.chunks.back().size - 1};
+      auto moved = std::lower_bound(destroys_.begin(), destroys_.end(), last);
+      if (slot < last && moved != destroys_.end() && !(last < *moved)) {
+        *moved = slot;
+        std::rotate(std::lower_bound(destroys_.begin(), moved, slot), moved,
+                    moved + 1);
+      }
+      KilledEntity e = RemoveEntity(architype, slot.chunk, slot.index);
+      auto update = [&](int32_t component, auto& field, const auto& value) {
+        if (!signiture[component]) {
+          field = std::nullopt;
+        } else if (added[component]) {
+          field = value;
+        }
+      };
+      update(Signiture::DEATH_TIME_INDEX, e.death_time, values.death_time);
+      update(Signiture::FADES_INDEX, e.fades, values.fades);
+      update(Signiture::EXPLODES_INDEX, e.explodes, values.explodes);
+      update(Signiture::GRAPHICS_INDEX, e.graphics, values.graphics);
+      update(Signiture::POSITION_INDEX, e.position, values.position);
+      update(Signiture::VELOCITY_INDEX, e.velocity, values.velocity);
+      AddEntity(signiture, e.death_time, e.fades, e.explodes, e.graphics,
+                e.position, e.velocity, e.id);
+    }
+  }
+
+  // Removes the destroyed entities into newly_dead_entities, in the order a
+  // scan from each architype's first entity to its last would: an entity is
+  // removed by moving the last one into its place, which is removed next if
+  // it was destroyed too.
+  void ApplyDestroys() {
+    for (size_t begin = 0, end = 0; begin < destroys_.size(); begin = end) {
+      Architype& architype = architypes_[destroys_[begin].architype];
+      end = begin;
+      while (end < destroys_.size() &&
+             destroys_[end].architype == destroys_[begin].architype) {
+        ++end;
+      }
+      auto position = [&](const EntitySlot& slot) {
+        return slot.chunk * architype.capacity + slot.index;
+      };
+      size_t lo = begin;
+      size_t hi = end;
+      while (lo < hi) {
+        const int32_t p = position(destroys_[lo++]);
+        while (true) {
+          const int32_t last = architype.size - 1;
+          newly_dead_entities.push_back(RemoveEntity(
+              architype, p / architype.capacity, p % architype.capacity));
+          FreeId(newly_dead_entities.back().id);
+          if (p == last || lo == hi || position(destroys_[hi - 1]) != last) {
+            break;
+          }
+          --hi;
         }
       }
     }
@@ -414,8 +1253,8 @@ class ECS {
   void RunMoveSystem() {
     const Signiture move_signiture({.hasPosition = true, .hasVelocity = true});
     RunSimpleSystem(move_signiture, [](Entity e) {
-      CompPosition& p = e.architype.position[e.id];
-      CompVelocity v = e.architype.velocity[e.id];
+      CompPosition& p = e.chunk.position[e.id];
+      CompVelocity v = e.chunk.velocity[e.id];
       p.x += v.dx;
       p.y += v.dy;
     });
@@ -425,17 +1264,47 @@ class ECS {
     const Signiture gravity_signiture(
         {.hasVelocity = true, .feelsGravity = true});
     RunSimpleSystem(gravity_signiture, [](Entity e) {
-      CompVelocity& v = e.architype.velocity[e.id];
+      CompVelocity& v = e.chunk.velocity[e.id];
       // TODO: Tune the gravity constant.
       v.dy -= 0.0003;
     });
   }
 
+  // Runs after Move and Gravity, so bodies are where they end the frame and
+  // new velocities take effect from the next one.
+  void RunCollisionSystem() {
+    const Signiture collision_signiture(
+        {.hasPosition = true, .hasVelocity = true, .feelsGravity = true});
+    collision_bodies_.clear();
+    collision_entities_.clear();
+    RunSimpleSystem(collision_signiture, [this](Entity e) {
+      CompPosition p = e.chunk.position[e.id];
+      CompVelocity v = e.chunk.velocity[e.id];
+      collision_bodies_.push_back(
+          {.x = p.x,
+           .y = p.y,
+           .dx = v.dx,
+           .dy = v.dy,
+           .index = static_cast<int32_t>(collision_entities_.size()),
+           .hit = false});
+      collision_entities_.push_back({e.chunk, e.id});
+    });
+    collision_grid_.Build(collision_bodies_);
+    collide_bodies(collision_grid_, 0, collision_bodies_.size(),
+                   collision_bodies_);
+    for (const CollisionBody& body : collision_bodies_) {
+      if (!body.hit) continue;
+      Entity e = collision_entities_[body.index];
+      e.chunk.position[e.id] = {.x = body.x, .y = body.y};
+      e.chunk.velocity[e.id] = {.dx = body.dx, .dy = body.dy};
+    }
+  }
+
   void RunFadeSystem() {
     const Signiture fade_signiture({.hasFades = true, .hasGraphics = true});
     RunSimpleSystem(fade_signiture, [](Entity e) {
-      Color& color = e.architype.graphics[e.id].color;
-      CompFades f = e.architype.fades[e.id];
+      Color& color = e.chunk.graphics[e.id].color;
+      CompFades f = e.chunk.fades[e.id];
       auto updateColor = [](uint8_t& c, uint8_t min, uint8_t rate) {
         c = std::max(c - rate, static_cast<int32_t>(min));
       };
@@ -451,18 +1320,91 @@ class ECS {
         {.hasGraphics = true, .hasPosition = true});
     std::vector<ToDraw> out;
     out.reserve(size_);
-    RunSimpleSystem(graphics_signiture, [&out](Entity e) {
-      CompGraphics g = e.architype.graphics[e.id];
-      CompPosition p = e.architype.position[e.id];
-      out.push_back({.color = g.color, .radius = g.radius, .x = p.x, .y = p.y});
+    cull_stats_ = CullStats();
+    RunSimpleSystem(graphics_signiture, [this, &out](Entity e) {
+      CompGraphics g = e.chunk.graphics[e.id];
+      CompPosition p = e.chunk.position[e.id];
+      ToDraw to_draw = {
+          .color = g.color, .radius = g.radius, .x = p.x, .y = p.y};
+      if (!Cull(to_draw)) out.push_back(to_draw);
     });
     return out;
   }
 
+  static std::string ArchitypeName(Signiture signiture) {
+    static constexpr const char* NAMES[] = {
+        "death_time", "fades",    "explodes", "graphics",
+        "position",   "velocity", "gravity"};
+    std::string name;
+    for (int32_t i = 0; i < Signiture::COUNT; ++i) {
+      if (!signiture[i]) continue;
+      if (!name.empty()) name += ' ';
+      name += NAMES[i];
+    }
+    return name;
+  }
+
+  // Returns true if the entity should not be drawn and records why.
+  bool Cull(const ToDraw& to_draw) {
+    if (to_draw.color.a < cull_.min_alpha) {
+      ++cull_stats_.faded;
+      return true;
+    }
+    if (to_draw.radius < cull_.min_radius) {
+      ++cull_stats_.too_small;
+      return true;
+    }
+    if (IsOffscreen(cull_, to_draw)) {
+      ++cull_stats_.offscreen;
+      return true;
+    }
+    return false;
+  }
+
+  // How Save records an architype. Its chunks follow the previous
+  // architype's in the snapshot.
+  struct SavedArchitype {
+    uint32_t signiture;
+    int32_t chunks;
+  };
+
+  // Chunks are saved whole, so their layout is part of the format.
+  static constexpr const char* SNAPSHOT_NAME = "acton-ecs-ids";
+
   std::vector<KilledEntity> newly_dead_entities;
+  Commands commands_;
+  // Reused by PlayBackCommands.
+  std::vector<EntitySlot> destroys_;
+  std::vector<Commands::Command> changes_;
+  std::vector<NewEntities> fireworks_;
+  // The chunks Death checks, with index unused.
+  std::vector<EntitySlot> death_chunks_;
+  // Must outlive the architypes that use it.
+  ChunkPool chunk_pool_;
   std::vector<Architype> architypes_;
   int32_t size_;
   int32_t max_;
+  int32_t entity_budget_ = std::numeric_limits<int32_t>::max();
+  // Ids handed out so far and the ones free for reuse.
+  int32_t next_id_ = 0;
+  std::vector<int32_t> free_ids_;
+  // The only sparse component so far.
+  static_assert(Signiture::SPARSE_BITS ==
+                1u << Signiture::FEELS_GRAVITY_INDEX);
+  SparseSet feels_gravity_;
+
+  CullSettings cull_;
+  CullStats cull_stats_;
+  SystemObserver* observer_ = nullptr;
+  std::vector<Explosion> explosions_;
+
+  bool collisions_ = false;
+  // Reused every frame by the collision system.
+  std::vector<CollisionBody> collision_bodies_;
+  std::vector<Entity> collision_entities_;
+  SpatialGrid<CollisionBody> collision_grid_{2 * COLLISION_RADIUS};
+
+  ThreadPool* pool_ = &ThreadPool::Default();
 
   pcg32 rng_;
 };
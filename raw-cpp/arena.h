@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#endif
+
+// Page level allocator for component storage.
+// A large range of address space is reserved up front and blocks are carved
+// out of it, so growing storage never has to move other mappings around.
+// Blocks of 2MB or more are huge page aligned and, when enabled, backed by
+// transparent huge pages or MAP_HUGETLB. New blocks can be pre-faulted on a
+// background thread so the first pass over them doesn't stall on page faults.
+// Freed blocks are kept and reused for later allocations of a similar size.
+class PageArena {
+ public:
+  static constexpr size_t PAGE_SIZE = 4096;
+  static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  struct Options {
+    // Ask for transparent huge pages on large blocks.
+    bool huge_pages = true;
+    // Try explicit MAP_HUGETLB pages first. These have to be reserved by the
+    // system, e.g. through /proc/sys/vm/nr_hugepages.
+    bool hugetlb = false;
+    // Fault in new blocks on a background thread.
+    bool prefault = true;
+    size_t reserve_bytes = size_t(64) << 30;
+  };
+
+  explicit PageArena(Options options) : options_(options) {
+#if defined(__linux__)
+    void* base = mmap(nullptr, options_.reserve_bytes + HUGE_PAGE_SIZE,
+                      PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+    if (base != MAP_FAILED) {
+      uintptr_t start = RoundUp(reinterpret_cast<uintptr_t>(base),
+                                HUGE_PAGE_SIZE);
+      next_ = reinterpret_cast<uint8_t*>(start);
+      end_ = next_ + options_.reserve_bytes;
+    }
+#endif
+  }
+
+  PageArena(const PageArena&) = delete;
+  PageArena& operator=(const PageArena&) = delete;
+
+  ~PageArena() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    prefault_wake_.notify_all();
+    if (prefaulter_.joinable()) prefaulter_.join();
+    // The address space itself is left for the process to release.
+  }
+
+  // Shared by all component storage. Configure it before the first ECS is
+  // created.
+  static PageArena& Default() {
+    static PageArena arena(Options{});
+    return arena;
+  }
+
+  void Configure(Options options) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options_.huge_pages = options.huge_pages;
+    options_.hugetlb = options.hugetlb;
+    options_.prefault = options.prefault;
+  }
+
+  // Returns a page aligned block of at least bytes. The contents are
+  // unspecified: fresh blocks are zero but recycled ones are not.
+  void* Allocate(size_t bytes) {
+    const size_t size = BlockSize(bytes);
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Reuse the smallest free block that fits without wasting over half.
+    auto free = free_.lower_bound(size);
+    if (free != free_.end() && free->first <= 2 * size) {
+      void* block = free->second;
+      free_.erase(free);
+      recycled_bytes_ -= sizes_[block];
+      if (released_.erase(block) != 0) released_bytes_ -= sizes_[block];
+      return block;
+    }
+    void* block = Map(size);
+    if (block == nullptr) throw std::bad_alloc();
+    sizes_[block] = size;
+    committed_bytes_ += size;
+    if (options_.prefault) Prefault(block, size);
+    return block;
+  }
+
+  void Free(void* block, size_t /*bytes*/) {
+    if (block == nullptr) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t size = sizes_[block];
+    free_.emplace(size, block);
+    recycled_bytes_ += size;
+  }
+
+  // Gives the pages of every block waiting for reuse back to the system.
+  // The blocks keep their address space and fault back in, zeroed, when
+  // they are reused. Returns the bytes given back by this call.
+  size_t ReleaseFree() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t released = 0;
+    for (const auto& [size, block] : free_) {
+      if (!released_.insert(block).second) continue;
+      ReleasePages(block, size);
+      released += size;
+    }
+    released_bytes_ += released;
+    return released;
+  }
+
+  // Bytes handed out or waiting for reuse.
+  size_t committed_bytes() const { return committed_bytes_; }
+  // Bytes freed and waiting for reuse.
+  size_t recycled_bytes() const { return recycled_bytes_; }
+  // Recycled bytes whose pages ReleaseFree gave back.
+  size_t released_bytes() const { return released_bytes_; }
+
+  // Drops the whole pages inside [begin, begin + bytes) so they stop using
+  // memory. They read as zero the next time they are touched. Only for
+  // storage whose contents are no longer needed.
+  static size_t ReleasePages(void* begin, size_t bytes) {
+    const uintptr_t start =
+        RoundUp(reinterpret_cast<uintptr_t>(begin), PAGE_SIZE);
+    const uintptr_t end =
+        (reinterpret_cast<uintptr_t>(begin) + bytes) / PAGE_SIZE * PAGE_SIZE;
+    if (end <= start) return 0;
+#if defined(__linux__)
+    if (madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED) !=
+        0) {
+      return 0;
+    }
+    return end - start;
+#else
+    return 0;
+#endif
+  }
+
+  // How much of [begin, begin + bytes) is in memory, in whole pages.
+  static size_t ResidentBytes(const void* begin, size_t bytes) {
+    if (bytes == 0) return 0;
+#if defined(__linux__)
+    const uintptr_t start =
+        reinterpret_cast<uintptr_t>(begin) / PAGE_SIZE * PAGE_SIZE;
+    const uintptr_t end =
+        RoundUp(reinterpret_cast<uintptr_t>(begin) + bytes, PAGE_SIZE);
+    std::vector<unsigned char> pages((end - start) / PAGE_SIZE);
+    if (mincore(reinterpret_cast<void*>(start), end - start, pages.data()) !=
+        0) {
+      return 0;
+    }
+    size_t resident = 0;
+    for (unsigned char page : pages) resident += page & 1;
+    return resident * PAGE_SIZE;
+#else
+    return bytes;
+#endif
+  }
+
+ private:
+  static size_t RoundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+  }
+
+  static size_t BlockSize(size_t bytes) {
+    return RoundUp(std::max<size_t>(bytes, 1),
+                   bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : PAGE_SIZE);
+  }
+
+  // Must be called with the lock held.
+  void* Map(size_t size) {
+#if defined(__linux__)
+    if (options_.hugetlb && size % HUGE_PAGE_SIZE == 0) {
+      void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (block != MAP_FAILED) return block;
+    }
+    uint8_t* block = nullptr;
+    if (next_ != nullptr && size <= size_t(end_ - next_)) {
+      // Keep huge page sized blocks huge page aligned.
+      if (size % HUGE_PAGE_SIZE == 0) {
+        next_ = reinterpret_cast<uint8_t*>(
+            RoundUp(reinterpret_cast<uintptr_t>(next_), HUGE_PAGE_SIZE));
+      }
+      if (size <= size_t(end_ - next_) &&
+          mprotect(next_, size, PROT_READ | PROT_WRITE) == 0) {
+        block = next_;
+        next_ += size;
+      }
+    }
+    if (block == nullptr) {
+      // Out of reserved space, so map the block on its own.
+      void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapped == MAP_FAILED) return nullptr;
+      block = static_cast<uint8_t*>(mapped);
+    }
+    if (options_.huge_pages && size >= HUGE_PAGE_SIZE) {
+      madvise(block, size, MADV_HUGEPAGE);
+    }
+    return block;
+#else
+    return std::aligned_alloc(PAGE_SIZE, size);
+#endif
+  }
+
+  // Must be called with the lock held.
+  void Prefault(void* block, size_t size) {
+#if defined(__linux__)
+    if (!prefaulter_.joinable()) {
+      prefaulter_ = std::thread([this] { PrefaultLoop(); });
+    }
+    prefault_queue_.emplace_back(static_cast<uint8_t*>(block), size);
+    prefault_wake_.notify_one();
+#else
+    (void)block;
+    (void)size;
+#endif
+  }
+
+  void PrefaultLoop() {
+#if defined(__linux__)
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      prefault_wake_.wait(
+          lock, [this] { return stopping_ || !prefault_queue_.empty(); });
+      if (stopping_) return;
+      auto [block, size] = prefault_queue_.front();
+      prefault_queue_.pop_front();
+      lock.unlock();
+      // A huge page at a time so whatever the main thread touches first
+      // isn't stuck behind the whole block. Populating never changes the
+      // contents, so it is safe while the block is in use.
+      for (size_t offset = 0; offset < size; offset += HUGE_PAGE_SIZE) {
+        size_t length = std::min(HUGE_PAGE_SIZE, size - offset);
+        if (madvise(block + offset, length, MADV_POPULATE_WRITE) != 0) break;
+      }
+      lock.lock();
+    }
+#endif
+  }
+
+  Options options_;
+  std::mutex mutex_;
+  uint8_t* next_ = nullptr;
+  uint8_t* end_ = nullptr;
+  std::multimap<size_t, void*> free_;
+  std::unordered_map<void*, size_t> sizes_;
+  size_t committed_bytes_ = 0;
+  size_t recycled_bytes_ = 0;
+  // Free blocks whose pages have been released.
+  std::unordered_set<void*> released_;
+  size_t released_bytes_ = 0;
+
+  std::thread prefaulter_;
+  std::condition_variable prefault_wake_;
+  std::deque<std::pair<uint8_t*, size_t>> prefault_queue_;
+  bool stopping_ = false;
+};
+
+// Standard allocator that gets its memory from the default PageArena.
+// Elements are default initialized rather than zeroed, so resizing a vector
+// of plain components doesn't write to every page up front.
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& /*other*/) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(PageArena::Default().Allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) {
+    PageArena::Default().Free(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  void construct(U* p) {
+    ::new (static_cast<void*>(p)) U;
+  }
+  template <typename U, typename... Args>
+  void construct(U* p, Args&&... args) {
+    ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+  }
+
+  friend bool operator==(const ArenaAllocator&, const ArenaAllocator&) {
+    return true;
+  }
+  friend bool operator!=(const ArenaAllocator&, const ArenaAllocator&) {
+    return false;
+  }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Structural changes recorded while a system runs and applied together
+// afterwards, so a system never creates, destroys or moves entities under
+// its own loop. A system split into blocks gives each block its own buffer
+// and the buffers are played back in block order, so the result doesn't
+// depend on which thread ran which block.
+// Entity is however the ECS refers to an existing entity until playback.
+// State is its EntityState, whose component bits name the components.
+// Record is a compact record of entities to make, like a whole explosion.
+// The ECS expands it at playback, which is where the rng is drawn from, so
+// recording one costs the same however many entities it turns into.
+template <typename Entity, typename State, typename Record>
+class CommandBuffer {
+ public:
+  enum class Op : uint8_t {
+    ADD_COMPONENT,
+    REMOVE_COMPONENT,
+  };
+
+  struct Command {
+    Op op;
+    // The component's bit in State::components.
+    int32_t component;
+    Entity entity;
+    // The added component's value.
+    State state;
+  };
+
+  void Destroy(Entity entity) { destroys_.push_back(entity); }
+
+  // Only the field of value for component is used.
+  void AddComponent(Entity entity, int32_t component, const State& value) {
+    commands_.push_back({.op = Op::ADD_COMPONENT,
+                         .component = component,
+                         .entity = entity,
+                         .state = value});
+  }
+
+  void RemoveComponent(Entity entity, int32_t component) {
+    commands_.push_back({.op = Op::REMOVE_COMPONENT,
+                         .component = component,
+                         .entity = entity,
+                         .state = {}});
+  }
+
+  void Create(const Record& record) { creates_.push_back(record); }
+
+  const std::vector<Entity>& destroys() const { return destroys_; }
+  const std::vector<Command>& commands() const { return commands_; }
+  const std::vector<Record>& creates() const { return creates_; }
+
+  // Keeps the storage for the next system.
+  void Clear() {
+    destroys_.clear();
+    commands_.clear();
+    creates_.clear();
+  }
+
+ private:
+  std::vector<Entity> destroys_;
+  std::vector<Command> commands_;
+  std::vector<Record> creates_;
+};
+
+// A CommandBuffer for every block of a system.
+template <typename Entity, typename State, typename Record>
+class CommandBuffers {
+ public:
+  using Buffer = CommandBuffer<Entity, State, Record>;
+  using Command = typename Buffer::Command;
+  using Op = typename Buffer::Op;
+
+  // Starts a system with blocks empty buffers.
+  void Reset(int32_t blocks) {
+    for (Buffer& buffer : buffers_) buffer.Clear();
+    if (int32_t(buffers_.size()) < blocks) buffers_.resize(blocks);
+    blocks_ = blocks;
+  }
+
+  Buffer& operator[](int32_t block) { return buffers_[block]; }
+
+  // Calls destroy(entity) for every destroyed entity, then change(command)
+  // for every component change and then create(record) for every create,
+  // each by block and then in the order they were recorded. Empties the
+  // buffers.
+  template <typename OnDestroy, typename OnChange, typename OnCreate>
+  void PlayBack(OnDestroy destroy, OnChange change, OnCreate create) {
+    for (int32_t b = 0; b < blocks_; ++b) {
+      for (const Entity& entity : buffers_[b].destroys()) destroy(entity);
+    }
+    for (int32_t b = 0; b < blocks_; ++b) {
+      for (const Command& command : buffers_[b].commands()) change(command);
+    }
+    for (int32_t b = 0; b < blocks_; ++b) {
+      for (const Record& record : buffers_[b].creates()) create(record);
+      buffers_[b].Clear();
+    }
+  }
+
+ private:
+  std::vector<Buffer> buffers_;
+  int32_t blocks_ = 0;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+// The hot loops are compiled once per variant below and one is picked at
+// startup, so the same binary uses AVX2 or AVX-512 on hosts that have them.
+#define ECS_MULTI_ISA 1
+#define ECS_TARGET_AVX2 __attribute__((target("avx2")))
+#define ECS_TARGET_AVX512 \
+  __attribute__((target("avx2,avx512f,avx512bw,avx512vl")))
+#endif
+
+// Instruction sets the kernels are compiled for, from least to most.
+enum class Isa { kBaseline, kAvx2, kAvx512 };
+
+template <Isa isa>
+using IsaConstant = std::integral_constant<Isa, isa>;
+
+inline const char* isa_name(Isa isa) {
+  switch (isa) {
+    case Isa::kAvx2:
+      return "avx2";
+    case Isa::kAvx512:
+      return "avx512";
+    default:
+      return "baseline";
+  }
+}
+
+inline bool isa_supported(Isa isa) {
+#if defined(ECS_MULTI_ISA)
+  __builtin_cpu_init();
+  switch (isa) {
+    case Isa::kAvx2:
+      return __builtin_cpu_supports("avx2");
+    case Isa::kAvx512:
+      return __builtin_cpu_supports("avx2") &&
+             __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw") &&
+             __builtin_cpu_supports("avx512vl");
+    default:
+      return true;
+  }
+#else
+  return isa == Isa::kBaseline;
+#endif
+}
+
+struct IsaChoice {
+  Isa isa;
+  // ECS_FORCE_ISA if it was set, and whether it could be used.
+  const char* forced;
+  bool honored;
+};
+
+// The best variant the host supports. ECS_FORCE_ISA=baseline, avx2 or
+// avx512 picks one instead for benchmarking. One the host can't run is
+// ignored.
+inline IsaChoice choose_isa() {
+  IsaChoice choice = {.isa = Isa::kBaseline,
+                      .forced = std::getenv("ECS_FORCE_ISA"),
+                      .honored = false};
+  for (Isa isa : {Isa::kBaseline, Isa::kAvx2, Isa::kAvx512}) {
+    if (!isa_supported(isa)) continue;
+    if (choice.forced != nullptr &&
+        std::strcmp(choice.forced, isa_name(isa)) == 0) {
+      choice.isa = isa;
+      choice.honored = true;
+      return choice;
+    }
+    choice.isa = isa;
+  }
+  return choice;
+}
+
+// Chosen the first time it is asked for and fixed after that.
+inline const IsaChoice& isa_choice() {
+  static const IsaChoice choice = choose_isa();
+  return choice;
+}
+
+inline Isa kernel_isa() { return isa_choice().isa; }
+
+#if defined(ECS_MULTI_ISA)
+// flatten inlines f and everything it calls, so the whole loop is compiled
+// for the variant and not just the call into it. AVX-512 brings FMA with
+// it, so contracting is turned off to keep every variant rounding floats
+// the same way and runs identical whichever one is picked.
+#define ECS_KERNEL_VARIANT \
+  __attribute__((flatten, optimize("fp-contract=off")))
+
+template <typename F>
+ECS_TARGET_AVX2 ECS_KERNEL_VARIANT void run_avx2(F& f) {
+  f(IsaConstant<Isa::kAvx2>());
+}
+
+template <typename F>
+ECS_TARGET_AVX512 ECS_KERNEL_VARIANT void run_avx512(F& f) {
+  f(IsaConstant<Isa::kAvx512>());
+}
+#endif
+
+// Calls f(isa) compiled for kernel_isa(). isa is an IsaConstant, so f can
+// pick intrinsics with if constexpr. Meant to wrap whole loops, since it
+// branches on every call.
+template <typename F>
+void dispatch_kernel(F f) {
+#if defined(ECS_MULTI_ISA)
+  switch (kernel_isa()) {
+    case Isa::kAvx512:
+      return run_avx512(f);
+    case Isa::kAvx2:
+      return run_avx2(f);
+    default:
+      break;
+  }
+#endif
+  f(IsaConstant<Isa::kBaseline>());
+}
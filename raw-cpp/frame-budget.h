@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <ostream>
+#include <string>
+
+// Scales the load the host asks of the world so step plus render time stays
+// under a target. Fewer explosion particles and fireworks cut the cost of
+// the frames coming up, and an entity cap below the live count cuts it as
+// entities die off. All three scale with one load factor.
+// Frame times are smoothed, and the load only changes after patience frames
+// in a row are over or under the target, so one slow frame or a burst of
+// explosions doesn't make it swing. It cuts quickly and raises slowly.
+// Decisions depend on how fast the host is, so runs with a budget aren't
+// reproducible.
+class FrameBudget {
+ public:
+  struct Options {
+    double target_ms = 1000.0 / 60.0;
+    // Cut when the smoothed time is over target_ms * over and raise when it
+    // is under target_ms * under. The gap between them is the hysteresis.
+    double over = 1.1;
+    double under = 0.8;
+    int32_t patience = 10;
+    // Cuts multiply the load, raises add to it.
+    double decrease = 0.75;
+    double increase = 0.05;
+    double min_load = 0.05;
+    // Weight of the newest frame in the smoothed time.
+    double smoothing = 0.1;
+  };
+
+  struct Metrics {
+    double target_ms = 0.0;
+    double smoothed_ms = 0.0;
+    // 1 is everything the host asked for.
+    double load = 1.0;
+    // Unlimited at full load.
+    int32_t entity_cap = std::numeric_limits<int32_t>::max();
+    int64_t cuts = 0;
+    int64_t raises = 0;
+    // Frames that took longer than target_ms, before smoothing.
+    int64_t frames_over = 0;
+    int64_t frames = 0;
+  };
+
+  explicit FrameBudget(Options options) : options_(options) {
+    metrics_.target_ms = options.target_ms;
+  }
+
+  // What to pass to Step for the next frame.
+  int32_t explosion_particles(int32_t full) const {
+    return std::max<int32_t>(1, std::lround(full * metrics_.load));
+  }
+  float spawn_rate(float full) const { return full * metrics_.load; }
+  int32_t entity_cap() const { return metrics_.entity_cap; }
+
+  // ms is how long the last frame's step and render took and entities is
+  // how many the world holds after it.
+  void Record(double ms, int32_t entities) {
+    Metrics& m = metrics_;
+    m.smoothed_ms = m.frames == 0 ? ms
+                                  : m.smoothed_ms * (1.0 - options_.smoothing) +
+                                        ms * options_.smoothing;
+    ++m.frames;
+    if (ms > options_.target_ms) ++m.frames_over;
+
+    if (m.smoothed_ms > options_.target_ms * options_.over) {
+      ++over_;
+      under_ = 0;
+    } else if (m.smoothed_ms < options_.target_ms * options_.under) {
+      ++under_;
+      over_ = 0;
+    } else {
+      over_ = under_ = 0;
+    }
+
+    if (over_ >= options_.patience && m.load > options_.min_load) {
+      m.load = std::max(options_.min_load, m.load * options_.decrease);
+      ++m.cuts;
+      over_ = 0;
+    } else if (under_ >= options_.patience && m.load < 1.0) {
+      m.load = std::min(1.0, m.load + options_.increase);
+      ++m.raises;
+      under_ = 0;
+    }
+    // The cap is the same share of the most entities there have been, so
+    // the world shrinks along with the load. Back at full load there is no
+    // cap at all and the host's own cap applies again.
+    peak_entities_ = std::max(peak_entities_, entities);
+    m.entity_cap = m.load >= 1.0 ? std::numeric_limits<int32_t>::max()
+                                 : std::max<int32_t>(
+                                       1, std::lround(peak_entities_ * m.load));
+  }
+
+  const Metrics& metrics() const { return metrics_; }
+
+  // One line, to go next to the FPS.
+  std::string Summary() const {
+    const Metrics& m = metrics_;
+    char cap[16] = "none";
+    if (m.entity_cap != std::numeric_limits<int32_t>::max()) {
+      std::snprintf(cap, sizeof(cap), "%d", m.entity_cap);
+    }
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "%.2fms of %.2fms, load %.2f, entity cap %s, %lld cuts "
+                  "%lld raises",
+                  m.smoothed_ms, m.target_ms, m.load, cap,
+                  static_cast<long long>(m.cuts),
+                  static_cast<long long>(m.raises));
+    return line;
+  }
+
+  void Report(std::ostream& out) const {
+    char line[64];
+    std::snprintf(line, sizeof(line), ", %lld of %lld frames over\n",
+                  static_cast<long long>(metrics_.frames_over),
+                  static_cast<long long>(metrics_.frames));
+    out << "Frame budget: " << Summary() << line;
+  }
+
+ private:
+  Options options_;
+  Metrics metrics_;
+  // Frames in a row the smoothed time has been over or under the target.
+  int32_t over_ = 0;
+  int32_t under_ = 0;
+  int32_t peak_entities_ = 0;
+};
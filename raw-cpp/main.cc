@@ -1,7 +1,14 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <set>
+#include <string>
 
 #include "SDL.h"
 #if defined(SIMPLE_ECS)
@@ -11,47 +18,590 @@ const char *NAME = "simple-ecs";
 #include "acton-inspired-ecs.h"
 const char *NAME = "acton-ecs";
 #endif
+#include "frame-budget.h"
+#include "perf-counters.h"
+#include "render.h"
+#include "replay.h"
+#include "shards.h"
+#include "trace.h"
 
 constexpr int WIDTH = 800;
 constexpr int HEIGHT = 600;
+constexpr int32_t EXPLOSION_PARTICLES = 16;
 
-void draw_circle(Color *pixels, float raw_center_x, float raw_center_y,
-                 float raw_radius, Color color) {
-  int center_x = std::round(raw_center_x * WIDTH);
-  int center_y = std::round((1.0 - raw_center_y) * HEIGHT);
-  int radius = std::max(
-      static_cast<int>(std::round(raw_radius * (HEIGHT + WIDTH) / 2.0)), 1);
-
-  uint8_t new_a_flip = (255 - color.a);
-  uint16_t new_ra = static_cast<uint16_t>(color.r * color.a) / 255;
-  uint16_t new_ga = static_cast<uint16_t>(color.g * color.a) / 255;
-  uint16_t new_ba = static_cast<uint16_t>(color.b * color.a) / 255;
-
-  int r2 = radius * radius;
-  for (int x = std::max(center_x - radius, 0);
-       x < std::min(center_x + radius, WIDTH); ++x) {
-    int x2 = (center_x - x) * (center_x - x);
-    for (int y = std::max(center_y - radius, 0);
-         y < std::min(center_y + radius, HEIGHT); ++y) {
-      int y2 = (center_y - y) * (center_y - y);
-      if (y2 + x2 <= r2) {
-        Color &pixel_color = pixels[x + WIDTH * y];
-
-        Color new_color;
-        new_color.a = 255;
-        new_color.r =
-            new_ra + static_cast<uint16_t>(pixel_color.r * new_a_flip) / 255;
-        new_color.g =
-            new_ga + static_cast<uint16_t>(pixel_color.g * new_a_flip) / 255;
-        new_color.b =
-            new_ba + static_cast<uint16_t>(pixel_color.b * new_a_flip) / 255;
-        pixel_color = new_color;
+struct Options {
+  bool headless = false;
+  int32_t frames = 600;
+  std::optional<uint64_t> seed;
+  int max_entities = 512;
+  float spawn_rate = 1.0f / 15.0f;
+  bool lod = false;
+  bool perf_counters = false;
+  bool memory_stats = false;
+  bool particle_bursts = false;
+  bool lazy_motion = false;
+  bool collisions = false;
+  int32_t shards = 1;
+  // Scale the load to keep frames under this many ms. 0 is off.
+  double frame_budget_ms = 0.0;
+  std::set<int32_t> dump_frames;
+  int32_t dump_every = 0;
+  std::string dump_dir = ".";
+  std::string record_trace;
+  std::string check_trace;
+  std::string load_snapshot;
+  std::string save_snapshot;
+  std::string record_input;
+  std::string replay;
+  PageArena::Options arena;
+};
+
+void print_usage() {
+  std::cerr
+      << "Usage: " << NAME << " [options]\n"
+      << "  --seed N           seed the simulation for reproducible runs\n"
+      << "  --max-entities N   initial entity cap (default 512)\n"
+      << "  --spawn-rate F     initial fireworks per frame (default 1/15)\n"
+      << "  --lod              splat 1 pixel particles as single pixels\n"
+      << "  --perf-counters    report time and hardware counters per system\n"
+      << "  --memory-stats     report memory held per component after the\n"
+      << "                     last headless frame. In a window 'm' releases\n"
+      << "                     unused memory and reports it\n"
+#if defined(SIMPLE_ECS)
+      << "  --particle-bursts  store explosion particles once per explosion\n"
+      << "  --lazy-motion      work out positions from velocities when read\n"
+      << "                     instead of moving entities every frame\n"
+#endif
+      << "  --collisions       bounce explosion particles off the ground and\n"
+      << "                     each other ('c' toggles it in a window)\n"
+      << "  --no-huge-pages    don't back component storage with huge pages\n"
+      << "  --hugetlb          try reserved MAP_HUGETLB pages first\n"
+      << "  --no-prefault      don't fault in component storage in the\n"
+      << "                     background\n"
+      << "  --shards N         split the world into N independent worlds\n"
+      << "                     stepped in parallel (headless only)\n"
+      << "  --frame-budget-ms F  cut explosion particles, fireworks and the\n"
+      << "                     entity cap while frames take longer than F ms\n"
+      << "                     and restore them once they fit. Runs with a\n"
+      << "                     budget depend on timing and don't reproduce,\n"
+      << "                     so it can't be used with traces or input logs\n"
+      << "  --headless         render into memory without opening a window\n"
+      << "  --frames N         frames to run when headless (default 600)\n"
+      << "  --dump-frames A,B  write these frames as PPM when headless\n"
+      << "  --dump-every N     write every Nth frame as PPM when headless\n"
+      << "  --dump-dir DIR     directory for dumped frames (default .)\n"
+      << "  --record-trace F   write a golden trace of --frames frames to F\n"
+      << "  --check-trace F    rerun the inputs of the trace in F and report\n"
+      << "                     the first frame and system that differ\n"
+      << "  --load-snapshot F  start from the world saved in F\n"
+      << "  --save-snapshot F  save the world to F after the last headless\n"
+      << "                     frame. In a window 's' saves to F and 'r'\n"
+      << "                     loads it (default world.snapshot)\n"
+      << "  --record-input F   write the seed, settings and key presses of a\n"
+      << "                     windowed session to F. Logs don't hold\n"
+      << "                     snapshots, so 'r' only loads one the session\n"
+      << "                     saved itself\n"
+      << "  --replay F         rerun the session recorded in F, with or\n"
+      << "                     without a window, and report frame times\n"
+      << "Set ECS_FORCE_ISA to baseline, avx2 or avx512 to pick the kernels\n"
+      << "instead of using the best ones the CPU supports.\n";
+}
+
+// Returns false if the arguments could not be parsed.
+bool parse_options(int argc, char *argv[], Options &options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char * {
+      return i + 1 < argc ? argv[++i] : nullptr;
+    };
+    if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--lod") {
+      options.lod = true;
+    } else if (arg == "--perf-counters") {
+      options.perf_counters = true;
+    } else if (arg == "--memory-stats") {
+      options.memory_stats = true;
+#if defined(SIMPLE_ECS)
+    } else if (arg == "--particle-bursts") {
+      options.particle_bursts = true;
+    } else if (arg == "--lazy-motion") {
+      options.lazy_motion = true;
+#endif
+    } else if (arg == "--collisions") {
+      options.collisions = true;
+    } else if (arg == "--no-huge-pages") {
+      options.arena.huge_pages = false;
+    } else if (arg == "--hugetlb") {
+      options.arena.hugetlb = true;
+    } else if (arg == "--no-prefault") {
+      options.arena.prefault = false;
+    } else if (arg == "--seed" || arg == "--max-entities" ||
+               arg == "--spawn-rate" || arg == "--frames" ||
+               arg == "--dump-frames" || arg == "--dump-every" ||
+               arg == "--dump-dir" || arg == "--record-trace" ||
+               arg == "--check-trace" || arg == "--load-snapshot" ||
+               arg == "--save-snapshot" || arg == "--record-input" ||
+               arg == "--replay" || arg == "--shards" ||
+               arg == "--frame-budget-ms") {
+      const char *v = value();
+      if (v == nullptr) return false;
+      if (arg == "--seed") {
+        options.seed = std::strtoull(v, nullptr, 10);
+      } else if (arg == "--max-entities") {
+        options.max_entities = std::max(1, std::atoi(v));
+      } else if (arg == "--spawn-rate") {
+        options.spawn_rate = std::strtof(v, nullptr);
+      } else if (arg == "--frames") {
+        options.frames = std::atoi(v);
+      } else if (arg == "--dump-frames") {
+        for (const char *p = v; *p != '\0';) {
+          char *end;
+          options.dump_frames.insert(std::strtol(p, &end, 10));
+          if (end == p) return false;
+          p = *end == ',' ? end + 1 : end;
+        }
+      } else if (arg == "--dump-every") {
+        options.dump_every = std::atoi(v);
+      } else if (arg == "--dump-dir") {
+        options.dump_dir = v;
+      } else if (arg == "--record-trace") {
+        options.record_trace = v;
+      } else if (arg == "--load-snapshot") {
+        options.load_snapshot = v;
+      } else if (arg == "--save-snapshot") {
+        options.save_snapshot = v;
+      } else if (arg == "--record-input") {
+        options.record_input = v;
+      } else if (arg == "--replay") {
+        options.replay = v;
+      } else if (arg == "--shards") {
+        options.shards = std::max(1, std::atoi(v));
+      } else if (arg == "--frame-budget-ms") {
+        options.frame_budget_ms = std::strtod(v, nullptr);
+      } else {
+        options.check_trace = v;
       }
+    } else {
+      return false;
     }
   }
+  return true;
+}
+
+// Changing the entity cap allocates all of the component storage, so it is
+// timed to show the cost of faulting it in.
+void set_max_entities(ECS &ecs, int32_t max_entities) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  ecs.SetMaxEntities(max_entities);
+  Uint64 end = SDL_GetPerformanceCounter();
+  std::cout << "Max Entities: " << max_entities << " (allocated in "
+            << (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f
+            << "ms)\n";
+}
+
+// Restores are timed since they are meant to be fast at millions of
+// entities. frame is set to the frame the snapshot was saved after.
+bool load_snapshot(ECS &ecs, const std::string &path, int32_t &frame) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (!ecs.Load(path, frame)) {
+    std::cerr << "Couldn't load snapshot " << path << '\n';
+    return false;
+  }
+  Uint64 end = SDL_GetPerformanceCounter();
+  std::cout << "Loaded " << path << " at frame " << frame << " ("
+            << ecs.size() << " entities in "
+            << (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f
+            << "ms)\n";
+  return true;
+}
+
+bool save_snapshot(const ECS &ecs, const std::string &path, int32_t frame) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (!ecs.Save(path, frame)) {
+    std::cerr << "Couldn't save snapshot " << path << '\n';
+    return false;
+  }
+  Uint64 end = SDL_GetPerformanceCounter();
+  std::cout << "Saved " << path << " at frame " << frame << " ("
+            << (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f
+            << "ms)\n";
+  return true;
+}
+
+// Hardware counters plus the profiler that attributes them to systems.
+struct Profiling {
+  PerfCounters counters;
+  SystemProfiler profiler{counters};
+};
+
+// Returns nullptr unless profiling was requested.
+std::unique_ptr<Profiling> start_profiling(const Options &options, ECS &ecs) {
+  if (!options.perf_counters) return nullptr;
+  auto profiling = std::make_unique<Profiling>();
+  if (!profiling->counters.available()) {
+    std::cerr << "Hardware counters unavailable (" << profiling->counters.error()
+              << "), only reporting time\n";
+  }
+  ecs.SetSystemObserver(&profiling->profiler);
+  return profiling;
 }
 
-int main() {
+// What the interactive keys change. Replays press the same keys, so a
+// recorded session changes the world exactly as it did live.
+struct Controls {
+  int32_t max_entities;
+  float spawn_rate;
+  bool lod;
+  bool render = true;
+  CullSettings cull = {.width = WIDTH, .height = HEIGHT};
+  // Where 's' saves and 'r' loads.
+  std::string snapshot = "world.snapshot";
+  // Input logs don't hold snapshots, so while recording or replaying 'r'
+  // only loads one that 's' saved earlier in the session. A replay saves it
+  // again before loading it.
+  bool session_snapshots_only = false;
+  bool saved_snapshot = false;
+  // The frame the next Step runs.
+  int32_t current_frame = 0;
+};
+
+Controls initial_controls(const Options &options) {
+  Controls controls = {.max_entities = options.max_entities,
+                       .spawn_rate = options.spawn_rate,
+                       .lod = options.lod};
+  if (!options.save_snapshot.empty()) {
+    controls.snapshot = options.save_snapshot;
+  } else if (!options.load_snapshot.empty()) {
+    controls.snapshot = options.load_snapshot;
+  }
+  controls.session_snapshots_only =
+      !options.record_input.empty() || !options.replay.empty();
+  return controls;
+}
+
+// Returns nothing unless a frame budget was asked for.
+std::optional<FrameBudget> start_frame_budget(const Options &options) {
+  if (options.frame_budget_ms <= 0.0) return std::nullopt;
+  return FrameBudget({.target_ms = options.frame_budget_ms});
+}
+
+// What the next Step should be asked to do, scaled by the budget if there
+// is one.
+struct FrameLoad {
+  float spawn_rate;
+  int32_t explosion_particles;
+};
+
+FrameLoad frame_load(const std::optional<FrameBudget> &budget, ECS &ecs,
+                     const Controls &controls) {
+  if (!budget) {
+    return {.spawn_rate = controls.spawn_rate,
+            .explosion_particles = EXPLOSION_PARTICLES};
+  }
+  ecs.SetEntityBudget(budget->entity_cap());
+  return {.spawn_rate = budget->spawn_rate(controls.spawn_rate),
+          .explosion_particles =
+              budget->explosion_particles(EXPLOSION_PARTICLES)};
+}
+
+void apply_key(SDL_Keycode key, ECS &ecs, Controls &controls) {
+  switch (key) {
+    case SDLK_LEFT:
+      controls.max_entities = std::max(1, controls.max_entities / 2);
+      set_max_entities(ecs, controls.max_entities);
+      break;
+    case SDLK_RIGHT:
+      controls.max_entities *= 2;
+      set_max_entities(ecs, controls.max_entities);
+      break;
+    case SDLK_DOWN:
+      controls.spawn_rate *= 1.0f / 1.1f;
+      std::cout << "Spawn Rate: " << controls.spawn_rate << '\n';
+      break;
+    case SDLK_UP:
+      controls.spawn_rate *= 1.1f;
+      std::cout << "Spawn Rate: " << controls.spawn_rate << '\n';
+      break;
+    case SDLK_x:
+      controls.render = !controls.render;
+      break;
+    case SDLK_s:
+      if (save_snapshot(ecs, controls.snapshot, controls.current_frame - 1)) {
+        controls.saved_snapshot = true;
+      }
+      break;
+    case SDLK_r: {
+      if (controls.session_snapshots_only && !controls.saved_snapshot) {
+        std::cout << "Nothing saved this session to load\n";
+        break;
+      }
+      int32_t saved_frame;
+      if (load_snapshot(ecs, controls.snapshot, saved_frame)) {
+        controls.current_frame = saved_frame + 1;
+      } else {
+        // A failed load leaves the world empty but keeps its cap.
+        controls.current_frame = 0;
+      }
+      controls.max_entities = ecs.max_entities();
+      break;
+    }
+    case SDLK_l:
+      controls.lod = !controls.lod;
+      std::cout << "LOD: " << (controls.lod ? "on" : "off") << '\n';
+      break;
+    case SDLK_COMMA:
+      controls.cull.min_alpha = std::max(controls.cull.min_alpha - 8, 1);
+      std::cout << "Min Alpha: " << int(controls.cull.min_alpha) << '\n';
+      ecs.SetCullSettings(controls.cull);
+      break;
+    case SDLK_PERIOD:
+      controls.cull.min_alpha = std::min(controls.cull.min_alpha + 8, 255);
+      std::cout << "Min Alpha: " << int(controls.cull.min_alpha) << '\n';
+      ecs.SetCullSettings(controls.cull);
+      break;
+    case SDLK_m: {
+      size_t released = ecs.ReleaseUnusedMemory();
+      std::cout << "Released " << released / (1024.0 * 1024.0) << "MB\n";
+      ecs.GetMemoryStats().Report(std::cout);
+      break;
+    }
+    case SDLK_c:
+      ecs.SetCollisions(!ecs.collisions());
+      std::cout << "Collisions: " << (ecs.collisions() ? "on" : "off")
+                << '\n';
+      break;
+#if defined(SIMPLE_ECS)
+    case SDLK_g:
+      ecs.SetParticleBursts(!ecs.particle_bursts());
+      std::cout << "Particle Bursts: "
+                << (ecs.particle_bursts() ? "on" : "off") << '\n';
+      break;
+    case SDLK_k:
+      ecs.SetLazyMotion(!ecs.lazy_motion());
+      std::cout << "Lazy Motion: " << (ecs.lazy_motion() ? "on" : "off")
+                << '\n';
+      break;
+#endif
+    default:
+      break;
+  }
+}
+
+// Presses the keys recorded for session frame frame.
+void replay_keys(const InputLog &replay, size_t &next_event, int32_t frame,
+                 ECS &ecs, Controls &controls) {
+  for (; next_event < replay.events.size() &&
+         replay.events[next_event].frame <= frame;
+       ++next_event) {
+    apply_key(replay.events[next_event].key, ecs, controls);
+  }
+}
+
+// Prints the hash of a headless frame and dumps it if it was asked for.
+// Returns false if the dump couldn't be written.
+bool output_frame(const Options &options, const Framebuffer &framebuffer,
+                  int32_t current_frame) {
+  char hash[17];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(framebuffer.Hash()));
+  std::cout << "frame " << current_frame << ' ' << hash << '\n';
+
+  bool dump = options.dump_frames.count(current_frame) > 0 ||
+              (options.dump_every > 0 &&
+               current_frame % options.dump_every == 0);
+  if (dump) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/frame-%06d.ppm", current_frame);
+    if (!framebuffer.WritePpm(options.dump_dir + name)) {
+      std::cerr << "Couldn't write " << options.dump_dir + name << '\n';
+      return false;
+    }
+  }
+  return true;
+}
+
+// Steps and renders a fixed number of frames into memory, printing a hash of
+// every frame so rendering changes can be diffed against a known good run.
+// With a replay the recorded keys are pressed before the frames they were
+// pressed in live.
+int run_headless(const Options &options, uint64_t seed,
+                 const InputLog *replay) {
+  ECS ecs(1, seed);
+  Controls controls = initial_controls(options);
+  ecs.SetCullSettings(controls.cull);
+#if defined(SIMPLE_ECS)
+  ecs.SetParticleBursts(options.particle_bursts);
+  ecs.SetLazyMotion(options.lazy_motion);
+#endif
+  ecs.SetCollisions(options.collisions);
+  // A snapshot brings its own entity cap and settings.
+  if (options.load_snapshot.empty()) {
+    set_max_entities(ecs, controls.max_entities);
+  } else {
+    int32_t saved_frame;
+    if (!load_snapshot(ecs, options.load_snapshot, saved_frame)) return 1;
+    controls.current_frame = saved_frame + 1;
+    controls.max_entities = ecs.max_entities();
+  }
+  Framebuffer framebuffer(WIDTH, HEIGHT);
+  auto profiling = start_profiling(options, ecs);
+  auto budget = start_frame_budget(options);
+  FrameStats frame_stats;
+  size_t next_event = 0;
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (int32_t frame = 0; frame < options.frames; ++frame) {
+    if (replay) replay_keys(*replay, next_event, frame, ecs, controls);
+    const int32_t current_frame = controls.current_frame++;
+    const FrameLoad load = frame_load(budget, ecs, controls);
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+    if (profiling) profiling->profiler.BeginFrame();
+    auto particles = ecs.Step(current_frame, load.spawn_rate,
+                              load.explosion_particles, controls.render);
+    if (profiling) profiling->profiler.EndFrame(ecs.size());
+    framebuffer.Clear();
+    if (controls.render) {
+      draw_particles(framebuffer.canvas(), particles, controls.lod);
+    }
+    const double frame_ms = (SDL_GetPerformanceCounter() - frame_start) /
+                            (double)SDL_GetPerformanceFrequency() * 1000.0;
+    frame_stats.Add(frame_ms);
+    if (budget) budget->Record(frame_ms, ecs.size());
+
+    if (!output_frame(options, framebuffer, current_frame)) return 1;
+  }
+  Uint64 end = SDL_GetPerformanceCounter();
+  float elapsed_ms =
+      (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f;
+  std::cerr << "Rendered " << options.frames << " frames in " << elapsed_ms
+            << "ms\n";
+  frame_stats.Report(std::cerr);
+  if (budget) budget->Report(std::cerr);
+  if (profiling) profiling->profiler.Report(std::cerr);
+  if (options.memory_stats) ecs.GetMemoryStats().Report(std::cerr);
+  if (!options.save_snapshot.empty() &&
+      !save_snapshot(ecs, options.save_snapshot, controls.current_frame - 1)) {
+    return 1;
+  }
+  return 0;
+}
+
+// Like run_headless, but with the world split into independent shards that
+// are stepped in parallel and drawn together. The entity cap and spawn rate
+// are for all of the shards.
+int run_sharded(const Options &options, uint64_t seed) {
+  ShardedWorlds<ECS> worlds(options.shards, 1, seed);
+  worlds.ForEach([&](ECS &ecs) {
+    ecs.SetCullSettings({.width = WIDTH, .height = HEIGHT});
+#if defined(SIMPLE_ECS)
+    ecs.SetParticleBursts(options.particle_bursts);
+    ecs.SetLazyMotion(options.lazy_motion);
+#endif
+    ecs.SetCollisions(options.collisions);
+  });
+  Uint64 start = SDL_GetPerformanceCounter();
+  worlds.SetMaxEntities(options.max_entities);
+  Uint64 end = SDL_GetPerformanceCounter();
+  std::cout << "Max Entities: " << options.max_entities << " over "
+            << options.shards << " shards (allocated in "
+            << (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f
+            << "ms)\n";
+  Framebuffer framebuffer(WIDTH, HEIGHT);
+  FrameStats frame_stats;
+
+  start = SDL_GetPerformanceCounter();
+  for (int32_t frame = 0; frame < options.frames; ++frame) {
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+    auto particles =
+        worlds.Step(frame, options.spawn_rate, EXPLOSION_PARTICLES);
+    framebuffer.Clear();
+    draw_particles(framebuffer.canvas(), particles, options.lod);
+    frame_stats.Add((SDL_GetPerformanceCounter() - frame_start) /
+                    (double)SDL_GetPerformanceFrequency() * 1000.0);
+    if (!output_frame(options, framebuffer, frame)) return 1;
+  }
+  end = SDL_GetPerformanceCounter();
+  float elapsed_ms =
+      (end - start) / (float)SDL_GetPerformanceFrequency() * 1000.0f;
+  std::cerr << "Rendered " << options.frames << " frames in " << elapsed_ms
+            << "ms\n";
+  frame_stats.Report(std::cerr);
+  return 0;
+}
+
+// Runs the simulation without rendering while hashing the state after every
+// system, then either saves the trace or compares it against a golden one.
+int run_trace(const Options &options, uint64_t seed) {
+  TraceHeader header = {.seed = seed,
+                        .max_entities = options.max_entities,
+                        .spawn_rate = options.spawn_rate,
+                        .frames = options.frames,
+                        .particle_bursts = options.particle_bursts,
+                        .lazy_motion = options.lazy_motion,
+                        .collisions = options.collisions};
+  std::vector<TraceEntry> golden;
+  if (!options.check_trace.empty() &&
+      !read_trace(options.check_trace, header, golden)) {
+    std::cerr << "Couldn't read trace " << options.check_trace << '\n';
+    return 1;
+  }
+
+  ECS ecs(header.max_entities, header.seed);
+  ecs.SetCullSettings({.width = WIDTH, .height = HEIGHT});
+#if defined(SIMPLE_ECS)
+  ecs.SetParticleBursts(header.particle_bursts);
+  ecs.SetLazyMotion(header.lazy_motion);
+#else
+  if (header.particle_bursts || header.lazy_motion) {
+    std::cerr << "The trace was recorded with particle bursts or lazy "
+                 "motion, which only the simple ECS has\n";
+    return 1;
+  }
+#endif
+  ecs.SetCollisions(header.collisions);
+  TraceRecorder<ECS> recorder(ecs);
+  ecs.SetSystemObserver(&recorder);
+  for (int32_t current_frame = 0; current_frame < header.frames;
+       ++current_frame) {
+    recorder.set_frame(current_frame);
+    auto particles =
+        ecs.Step(current_frame, header.spawn_rate, EXPLOSION_PARTICLES);
+    recorder.RecordDraw(particles);
+  }
+  ecs.SetSystemObserver(nullptr);
+
+  if (!options.record_trace.empty()) {
+    if (!write_trace(options.record_trace, header, recorder.entries())) {
+      std::cerr << "Couldn't write trace " << options.record_trace << '\n';
+      return 1;
+    }
+    std::cout << "Recorded " << recorder.entries().size() << " entries\n";
+  }
+  if (!options.check_trace.empty()) {
+    auto divergence = first_divergence(golden, recorder.entries());
+    if (divergence) {
+      std::cout << "Diverged at frame " << divergence->frame << " after "
+                << divergence->system << ": ";
+      if (!divergence->actual) {
+        std::cout << "only the golden trace ran it\n";
+      } else if (!divergence->expected) {
+        std::cout << "the golden trace didn't run it\n";
+      } else {
+        std::cout << "expected " << std::hex << *divergence->expected
+                  << " got " << *divergence->actual << std::dec << '\n';
+      }
+      return 1;
+    }
+    std::cout << "Matches " << options.check_trace << '\n';
+  }
+  return 0;
+}
+
+// With a replay the live keys are ignored and the window closes after the
+// recorded session's last frame.
+int run_windowed(const Options &options, uint64_t seed,
+                 const InputLog *replay) {
   SDL_Window *window;
   SDL_Renderer *renderer;
   SDL_Texture *texture;
@@ -86,12 +636,50 @@ int main() {
     return 3;
   }
 
-  int max_entities = 512;
-  ECS ecs(max_entities);
-  int32_t frames = 0, current_frame = 0;
+  ECS ecs(1, seed);
+  Controls controls = initial_controls(options);
+  set_max_entities(ecs, controls.max_entities);
+  ecs.SetCullSettings(controls.cull);
+#if defined(SIMPLE_ECS)
+  ecs.SetParticleBursts(options.particle_bursts);
+  ecs.SetLazyMotion(options.lazy_motion);
+#endif
+  ecs.SetCollisions(options.collisions);
+  auto profiling = start_profiling(options, ecs);
+  if (!options.load_snapshot.empty()) {
+    int32_t saved_frame;
+    if (!load_snapshot(ecs, options.load_snapshot, saved_frame)) return 1;
+    controls.current_frame = saved_frame + 1;
+    controls.max_entities = ecs.max_entities();
+  }
+  std::optional<InputRecorder> recorder;
+  if (!options.record_input.empty()) {
+    recorder.emplace();
+    InputLog start = {.seed = seed,
+                      .max_entities = options.max_entities,
+                      .spawn_rate = options.spawn_rate,
+                      .lod = options.lod,
+                      .particle_bursts = options.particle_bursts,
+                      .lazy_motion = options.lazy_motion,
+                      .collisions = options.collisions,
+                      .events = {},
+                      .frames = 0};
+    if (!recorder->Open(options.record_input, start)) {
+      std::cerr << "Couldn't write " << options.record_input << '\n';
+      return 1;
+    }
+  }
+  auto budget = start_frame_budget(options);
+  FrameStats frame_stats;
+  size_t next_event = 0;
+  // Frames since the window opened, which is what recorded keys are timed
+  // by. Loading a snapshot moves current_frame but not this.
+  int32_t session_frame = 0;
+  int32_t frames = 0;
   int32_t entity_count = 0;
-  float spawn_rate = 1.0f / 15.0f;
-  bool render = true;
+  int64_t culled_count = 0, splat_count = 0;
+  double uploaded_fraction = 0.0;
+  Framebuffer framebuffer(WIDTH, HEIGHT);
   Uint32 last_print = SDL_GetTicks();
   while (true) {
     Uint64 start = SDL_GetPerformanceCounter();
@@ -100,58 +688,71 @@ int main() {
     if (has_events) {
       if (event.type == SDL_QUIT) {
         break;
-      } else if (event.type == SDL_KEYDOWN && event.key.repeat == 0) {
-        switch (event.key.keysym.sym) {
-          case SDLK_LEFT:
-            max_entities = std::max(1, max_entities / 2);
-            std::cout << "Max Entities: " << max_entities << '\n';
-            ecs.SetMaxEntities(max_entities);
-            break;
-          case SDLK_RIGHT:
-            max_entities *= 2;
-            std::cout << "Max Entities: " << max_entities << '\n';
-            ecs.SetMaxEntities(max_entities);
-            break;
-          case SDLK_DOWN:
-            spawn_rate *= 1.0f / 1.1f;
-            std::cout << "Spawn Rate: " << spawn_rate << '\n';
-            break;
-          case SDLK_UP:
-            spawn_rate *= 1.1f;
-            std::cout << "Spawn Rate: " << spawn_rate << '\n';
-            break;
-          case SDLK_x:
-            render = !render;
-            break;
-          default:
-            break;
-        }
+      } else if (event.type == SDL_KEYDOWN && event.key.repeat == 0 &&
+                 replay == nullptr) {
+        // Replays only take their keys from the log.
+        if (recorder) recorder->Key(session_frame, event.key.keysym.sym);
+        apply_key(event.key.keysym.sym, ecs, controls);
       }
     }
+    if (replay) {
+      if (session_frame >= replay->frames) break;
+      replay_keys(*replay, next_event, session_frame, ecs, controls);
+    }
     SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
-    auto particles = ecs.Step(current_frame, spawn_rate, 16);
-    if (render) {
-      void *pixels = nullptr;
-      int pitch;
-      SDL_LockTexture(texture, NULL, &pixels, &pitch);
-      memset(pixels, 0, WIDTH * HEIGHT * sizeof(Uint32));
-      for (const auto &to_draw : particles) {
-        draw_circle(reinterpret_cast<Color *>(pixels), to_draw.x, to_draw.y,
-                    to_draw.radius, to_draw.color);
-      }
-      SDL_UnlockTexture(texture);
+    const FrameLoad load = frame_load(budget, ecs, controls);
+    Uint64 frame_start = SDL_GetPerformanceCounter();
+    if (profiling) profiling->profiler.BeginFrame();
+    // Nothing needs drawing while rendering is off.
+    auto particles = ecs.Step(controls.current_frame, load.spawn_rate,
+                              load.explosion_particles, controls.render);
+    if (profiling) profiling->profiler.EndFrame(ecs.size());
+    if (controls.render) {
+      // Only the tiles drawn this frame or the last are cleared and
+      // uploaded, the rest of the texture already holds them.
+      framebuffer.Clear();
+      splat_count +=
+          draw_particles(framebuffer.canvas(), particles, controls.lod);
+      framebuffer.ForEachChanged([&](PixelRect rect) {
+        SDL_Rect area = {
+            .x = rect.x, .y = rect.y, .w = rect.width, .h = rect.height};
+        SDL_UpdateTexture(texture, &area, framebuffer.pixel(rect.x, rect.y),
+                          framebuffer.pitch());
+      });
+      uploaded_fraction += framebuffer.changed_fraction();
       SDL_RenderClear(renderer);
       SDL_RenderCopy(renderer, texture, NULL, NULL);
       SDL_RenderPresent(renderer);
     }
+    const double frame_ms = (SDL_GetPerformanceCounter() - frame_start) /
+                            (double)SDL_GetPerformanceFrequency() * 1000.0;
+    frame_stats.Add(frame_ms);
+    if (budget) budget->Record(frame_ms, ecs.size());
     entity_count = std::max(entity_count, ecs.size());
-    ++current_frame;
+    if (controls.render) culled_count += ecs.cull_stats().total();
+    ++controls.current_frame;
+    ++session_frame;
     ++frames;
 
     if (SDL_GetTicks() - last_print > 1000) {
       std::cout << "Current FPS: " << std::to_string(frames) << "\t\t";
-      std::cout << "Max Entities: " << std::to_string(entity_count) << '\n';
+      std::cout << "Max Entities: " << std::to_string(entity_count) << "\t\t";
+      std::cout << "Culled/Frame: " << std::to_string(culled_count / frames)
+                << "\t\t";
+      std::cout << "Splats/Frame: " << std::to_string(splat_count / frames)
+                << "\t\t";
+      std::cout << "Uploaded/Frame: "
+                << std::to_string(
+                       static_cast<int>(100 * uploaded_fraction / frames))
+                << "%\t\t";
+      std::cout << "Memory: " << ecs.GetMemoryStats().Summary();
+      if (budget) std::cout << "\t\tBudget: " << budget->Summary();
+      std::cout << '\n';
+      if (profiling) profiling->profiler.Report(std::cout);
       entity_count = 0;
+      culled_count = 0;
+      splat_count = 0;
+      uploaded_fraction = 0.0;
       frames = 0;
       last_print = SDL_GetTicks();
     }
@@ -165,6 +766,9 @@ int main() {
       SDL_Delay(delay);
     }
   }
+  if (recorder) recorder->End(session_frame);
+  if (replay) frame_stats.Report(std::cout);
+  if (budget) budget->Report(std::cout);
 
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
@@ -173,3 +777,77 @@ int main() {
 
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    print_usage();
+    return 1;
+  }
+  // Input logs start from a fresh world, so they can't start from a
+  // snapshot.
+  if (!options.load_snapshot.empty() &&
+      (!options.record_input.empty() || !options.replay.empty())) {
+    std::cerr << "Input logs don't hold snapshots, so --load-snapshot can't "
+                 "be used with --record-input or --replay\n";
+    return 1;
+  }
+  // Logs don't record the caps a budget picked, which depend on timing.
+  if (options.frame_budget_ms > 0.0 &&
+      (!options.record_input.empty() || !options.replay.empty())) {
+    std::cerr << "--frame-budget-ms depends on timing, so it can't be used "
+                 "with --record-input or --replay\n";
+    return 1;
+  }
+  // A replay reruns the recorded session's settings.
+  std::optional<InputLog> replay;
+  if (!options.replay.empty()) {
+    replay.emplace();
+    if (!read_input_log(options.replay, *replay)) {
+      std::cerr << "Couldn't read input log " << options.replay << '\n';
+      return 1;
+    }
+    options.seed = replay->seed;
+    options.max_entities = replay->max_entities;
+    options.spawn_rate = replay->spawn_rate;
+    options.lod = replay->lod;
+    options.particle_bursts = replay->particle_bursts;
+    options.lazy_motion = replay->lazy_motion;
+    options.collisions = replay->collisions;
+    options.frames = replay->frames;
+  }
+  uint64_t seed = options.seed ? *options.seed : std::random_device{}();
+  std::cout << "Seed: " << seed << '\n';
+  const IsaChoice &isa = isa_choice();
+  std::cout << "Kernels: " << isa_name(isa.isa);
+  if (isa.forced != nullptr) {
+    std::cout << (isa.honored ? " (forced by ECS_FORCE_ISA)"
+                              : " (ECS_FORCE_ISA=" + std::string(isa.forced) +
+                                    " isn't supported here)");
+  }
+  std::cout << '\n';
+  PageArena::Default().Configure(options.arena);
+
+  if (options.shards > 1) {
+    if (!options.headless || replay || !options.record_trace.empty() ||
+        !options.check_trace.empty() || !options.load_snapshot.empty() ||
+        !options.save_snapshot.empty() || options.perf_counters ||
+        options.frame_budget_ms > 0.0) {
+      std::cerr << "--shards only runs headless, without traces, replays, "
+                   "snapshots, perf counters or a frame budget\n";
+      return 1;
+    }
+    return run_sharded(options, seed);
+  }
+  if (!options.record_trace.empty() || !options.check_trace.empty()) {
+    if (options.frame_budget_ms > 0.0) {
+      std::cerr << "--frame-budget-ms depends on timing, so it can't be "
+                   "used with traces\n";
+      return 1;
+    }
+    return run_trace(options, seed);
+  }
+  const InputLog *log = replay ? &*replay : nullptr;
+  return options.headless ? run_headless(options, seed, log)
+                          : run_windowed(options, seed, log);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+
+// What one part of an ECS's storage holds, in bytes and in entities.
+struct MemoryUsage {
+  std::string name;
+  // Entities stored and the entities there is room for.
+  int64_t live = 0;
+  int64_t capacity = 0;
+  size_t reserved_bytes = 0;
+  // The bytes holding live entities.
+  size_t used_bytes = 0;
+
+  size_t wasted_bytes() const { return reserved_bytes - used_bytes; }
+};
+
+// How much memory an ECS holds and how much of it is in use, from
+// ECS::MemoryStats(). Taken between frames.
+struct MemoryStats {
+  int64_t live = 0;
+  int64_t capacity = 0;
+  // Everything the ECS holds for entities: components plus the ECS's own
+  // per entity bookkeeping.
+  size_t reserved_bytes = 0;
+  size_t used_bytes = 0;
+  // The part of reserved_bytes that is actually in memory, since storage
+  // is only backed by memory once it is touched.
+  size_t resident_bytes = 0;
+  std::vector<MemoryUsage> components;
+  // Only the acton ECS groups entities by architype.
+  std::vector<MemoryUsage> architypes;
+  // The PageArena all component storage comes from, shared by every ECS.
+  size_t arena_committed_bytes = 0;
+  size_t arena_recycled_bytes = 0;
+  size_t arena_released_bytes = 0;
+
+  size_t wasted_bytes() const { return reserved_bytes - used_bytes; }
+
+  // Adds a part to the totals and to list.
+  void Add(std::vector<MemoryUsage>& list, MemoryUsage usage) {
+    reserved_bytes += usage.reserved_bytes;
+    used_bytes += usage.used_bytes;
+    list.push_back(std::move(usage));
+  }
+
+  void SetArena(const PageArena& arena) {
+    arena_committed_bytes = arena.committed_bytes();
+    arena_recycled_bytes = arena.recycled_bytes();
+    arena_released_bytes = arena.released_bytes();
+  }
+
+  // One line, to go next to the FPS.
+  std::string Summary() const {
+    char line[128];
+    std::snprintf(line, sizeof(line),
+                  "%.1fMB used of %.1fMB (%.1fMB resident)", Mb(used_bytes),
+                  Mb(reserved_bytes), Mb(resident_bytes));
+    return line;
+  }
+
+  void Report(std::ostream& out) const {
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "Memory: %lld of %lld entities, %s, %.1fMB wasted\n",
+                  static_cast<long long>(live),
+                  static_cast<long long>(capacity), Summary().c_str(),
+                  Mb(wasted_bytes()));
+    out << line;
+    auto table = [&](const char* title, const std::vector<MemoryUsage>& list) {
+      if (list.empty()) return;
+      std::snprintf(line, sizeof(line), "  %-28s %10s %10s %10s %10s %10s\n",
+                    title, "live", "capacity", "reserved", "used", "wasted");
+      out << line;
+      for (const MemoryUsage& usage : list) {
+        std::snprintf(line, sizeof(line),
+                      "  %-28s %10lld %10lld %8.1fMB %8.1fMB %8.1fMB\n",
+                      usage.name.c_str(), static_cast<long long>(usage.live),
+                      static_cast<long long>(usage.capacity),
+                      Mb(usage.reserved_bytes), Mb(usage.used_bytes),
+                      Mb(usage.wasted_bytes()));
+        out << line;
+      }
+    };
+    table("component", components);
+    table("architype", architypes);
+    std::snprintf(line, sizeof(line),
+                  "  Arena: %.1fMB committed, %.1fMB free for reuse of "
+                  "which %.1fMB released\n",
+                  Mb(arena_committed_bytes), Mb(arena_recycled_bytes),
+                  Mb(arena_released_bytes));
+    out << line;
+  }
+
+ private:
+  static double Mb(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+};
+
+// The usage of a vector with an element for each of live entities.
+template <typename Vector>
+MemoryUsage vector_usage(const char* name, const Vector& vector,
+                         int64_t live) {
+  constexpr size_t SIZE = sizeof(typename Vector::value_type);
+  return {.name = name,
+          .live = live,
+          .capacity = static_cast<int64_t>(vector.capacity()),
+          .reserved_bytes = vector.capacity() * SIZE,
+          .used_bytes = live * SIZE};
+}
@@ -0,0 +1,229 @@
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware performance counters for the calling thread, read through
+// perf_event_open. If the kernel or its perf_event_paranoid setting doesn't
+// allow them, available() is false and every reading is zero, so callers can
+// always fall back to just the timings.
+// Work done on other threads is not counted.
+class PerfCounters {
+ public:
+  enum Event {
+    CYCLES,
+    INSTRUCTIONS,
+    L1D_MISSES,
+    LLC_MISSES,
+    BRANCH_MISSES,
+    DTLB_MISSES,
+    EVENT_COUNT,
+  };
+  using Values = std::array<uint64_t, EVENT_COUNT>;
+
+  static const char* Name(Event event) {
+    static const char* names[EVENT_COUNT] = {
+        "cycles", "instrs", "L1D miss", "LLC miss", "br miss", "dTLB miss",
+    };
+    return names[event];
+  }
+
+  PerfCounters() {
+    fds_.fill(-1);
+#if defined(__linux__)
+    const std::pair<uint32_t, uint64_t> configs[EVENT_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+    for (int i = 0; i < EVENT_COUNT; ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = configs[i].first;
+      attr.config = configs[i].second;
+      attr.disabled = leader() == -1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader(), 0);
+      if (fd < 0) {
+        // Without the cycles leader there is no group to read.
+        if (i == CYCLES) {
+          error_ = std::strerror(errno);
+          return;
+        }
+        continue;
+      }
+      fds_[i] = fd;
+      ioctl(fd, PERF_EVENT_IOC_ID, &ids_[i]);
+    }
+    ioctl(leader(), PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader(), PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    error_ = "perf_event_open is Linux only";
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+#endif
+  }
+
+  bool available() const { return leader() != -1; }
+  bool available(Event event) const { return fds_[event] != -1; }
+  // Why the counters are unavailable.
+  const std::string& error() const { return error_; }
+
+  // Running totals since construction.
+  Values Read() const {
+    Values values = {};
+#if defined(__linux__)
+    if (!available()) return values;
+    struct {
+      uint64_t nr;
+      struct {
+        uint64_t value;
+        uint64_t id;
+      } events[EVENT_COUNT];
+    } group;
+    if (read(leader(), &group, sizeof(group)) < 0) return values;
+    for (uint64_t i = 0; i < group.nr && i < EVENT_COUNT; ++i) {
+      for (int event = 0; event < EVENT_COUNT; ++event) {
+        if (fds_[event] != -1 && ids_[event] == group.events[i].id) {
+          values[event] = group.events[i].value;
+        }
+      }
+    }
+#endif
+    return values;
+  }
+
+ private:
+  int leader() const { return fds_[CYCLES]; }
+
+  std::array<int, EVENT_COUNT> fds_;
+  std::array<uint64_t, EVENT_COUNT> ids_ = {};
+  std::string error_;
+};
+
+// Attributes counters and time to every system in ECS::Step and to whole
+// frames, normalized per entity. SystemObserver comes from the ECS header.
+class SystemProfiler : public SystemObserver {
+ public:
+  explicit SystemProfiler(const PerfCounters& counters)
+      : counters_(counters) {}
+
+  void BeforeSystem(const char* /*system*/) override { system_start_ = Now(); }
+
+  void AfterSystem(const char* system) override {
+    Add(Find(system), system_start_, Now());
+  }
+
+  void BeginFrame() { frame_start_ = Now(); }
+
+  // entities is the number of entities the frame ran over.
+  void EndFrame(int64_t entities) {
+    Add(frame_, frame_start_, Now());
+    entities_ += entities;
+  }
+
+  // Prints averages per entity since the last report and resets them.
+  void Report(std::ostream& out) {
+    if (entities_ == 0) return;
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-10s %9s", "Per entity", "ns");
+    out << line;
+    for (int event = 0; event < PerfCounters::EVENT_COUNT; ++event) {
+      if (!counters_.available(PerfCounters::Event(event))) continue;
+      std::snprintf(line, sizeof(line), " %9s",
+                    PerfCounters::Name(PerfCounters::Event(event)));
+      out << line;
+    }
+    out << '\n';
+    auto print = [&](const std::string& name, Totals& totals) {
+      std::snprintf(line, sizeof(line), "%-10s %9.3f", name.c_str(),
+                    double(totals.nanos) / entities_);
+      out << line;
+      for (int event = 0; event < PerfCounters::EVENT_COUNT; ++event) {
+        if (!counters_.available(PerfCounters::Event(event))) continue;
+        std::snprintf(line, sizeof(line), " %9.3f",
+                      double(totals.values[event]) / entities_);
+        out << line;
+      }
+      out << '\n';
+      totals = Totals();
+    };
+    print("Frame", frame_);
+    for (auto& [name, totals] : systems_) {
+      print(name, totals);
+    }
+    entities_ = 0;
+  }
+
+ private:
+  struct Sample {
+    std::chrono::steady_clock::time_point time;
+    PerfCounters::Values values;
+  };
+
+  struct Totals {
+    uint64_t nanos = 0;
+    PerfCounters::Values values = {};
+  };
+
+  Sample Now() const {
+    return {std::chrono::steady_clock::now(), counters_.Read()};
+  }
+
+  static void Add(Totals& totals, const Sample& start, const Sample& end) {
+    totals.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        end.time - start.time)
+                        .count();
+    for (int event = 0; event < PerfCounters::EVENT_COUNT; ++event) {
+      totals.values[event] += end.values[event] - start.values[event];
+    }
+  }
+
+  // Systems are kept in the order they first ran.
+  Totals& Find(const char* system) {
+    for (auto& [name, totals] : systems_) {
+      if (name == system) return totals;
+    }
+    systems_.emplace_back(system, Totals());
+    return systems_.back().second;
+  }
+
+  const PerfCounters& counters_;
+  Sample system_start_;
+  Sample frame_start_;
+  Totals frame_;
+  std::vector<std::pair<std::string, Totals>> systems_;
+  int64_t entities_ = 0;
+};
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "cpu-dispatch.h"
+
+// Software rasterizer shared by the windowed and headless hosts.
+// Color and ToDraw come from whichever ECS header was included first.
+
+// Which square tiles of a render target have been drawn to, so clearing and
+// uploading can skip the rest. Tiles on the right and bottom edges may be
+// cut short by the target.
+class DirtyTiles {
+ public:
+  static constexpr int TILE_SIZE = 32;
+
+  DirtyTiles(int width, int height)
+      : columns_((width + TILE_SIZE - 1) / TILE_SIZE),
+        rows_((height + TILE_SIZE - 1) / TILE_SIZE),
+        tiles_(columns_ * rows_, 0) {}
+
+  int columns() const { return columns_; }
+  int rows() const { return rows_; }
+  bool dirty(int column, int row) const {
+    return tiles_[row * columns_ + column];
+  }
+  int64_t count() const { return count_; }
+
+  // Marks the tiles overlapping pixels [x0, x1) x [y0, y1). The box must
+  // already be clipped to the target.
+  void Mark(int x0, int y0, int x1, int y1) {
+    if (x0 >= x1 || y0 >= y1) return;
+    for (int row = y0 / TILE_SIZE; row <= (y1 - 1) / TILE_SIZE; ++row) {
+      uint8_t *tile = &tiles_[row * columns_];
+      for (int column = x0 / TILE_SIZE; column <= (x1 - 1) / TILE_SIZE;
+           ++column) {
+        count_ += !tile[column];
+        tile[column] = 1;
+      }
+    }
+  }
+
+  void MarkAll() {
+    std::fill(tiles_.begin(), tiles_.end(), 1);
+    count_ = tiles_.size();
+  }
+
+  void Clear() {
+    std::fill(tiles_.begin(), tiles_.end(), 0);
+    count_ = 0;
+  }
+
+  // Adds the tiles marked in other, which must be the same size.
+  void Merge(const DirtyTiles &other) {
+    count_ = 0;
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+      tiles_[i] |= other.tiles_[i];
+      count_ += tiles_[i];
+    }
+  }
+
+  // Calls f(column, row, columns) for each run of dirty tiles in a row.
+  template <typename F>
+  void ForEachRun(F f) const {
+    for (int row = 0; row < rows_; ++row) {
+      for (int column = 0; column < columns_;) {
+        if (!dirty(column, row)) {
+          ++column;
+          continue;
+        }
+        int end = column + 1;
+        while (end < columns_ && dirty(end, row)) ++end;
+        f(column, row, end - column);
+        column = end;
+      }
+    }
+  }
+
+ private:
+  int columns_;
+  int rows_;
+  std::vector<uint8_t> tiles_;
+  int64_t count_ = 0;
+};
+
+// A view of pixels to draw into. The stride is in pixels, not bytes.
+struct Canvas {
+  Color *pixels;
+  int width;
+  int height;
+  int stride;
+  // Where drawing is recorded, if anywhere.
+  DirtyTiles *dirty = nullptr;
+
+  Color *row(int y) const { return pixels + stride * y; }
+};
+
+struct PixelCircle {
+  int center_x;
+  int center_y;
+  int radius;
+};
+
+inline PixelCircle to_pixels(const Canvas &canvas, float raw_center_x,
+                             float raw_center_y, float raw_radius) {
+  return {
+      .center_x = static_cast<int>(std::round(raw_center_x * canvas.width)),
+      .center_y =
+          static_cast<int>(std::round((1.0 - raw_center_y) * canvas.height)),
+      .radius = std::max(static_cast<int>(std::round(
+                             raw_radius * (canvas.height + canvas.width) / 2.0)),
+                         1),
+  };
+}
+
+// Color premultiplied by its alpha so blending a pixel is just a scale and add.
+struct BlendColor {
+  uint8_t a_flip;
+  uint16_t ra;
+  uint16_t ga;
+  uint16_t ba;
+
+  explicit BlendColor(Color color)
+      : a_flip(255 - color.a),
+        ra(static_cast<uint16_t>(color.r * color.a) / 255),
+        ga(static_cast<uint16_t>(color.g * color.a) / 255),
+        ba(static_cast<uint16_t>(color.b * color.a) / 255) {}
+
+  void Apply(Color &pixel_color) const {
+    Color new_color;
+    new_color.a = 255;
+    new_color.r = ra + static_cast<uint16_t>(pixel_color.r * a_flip) / 255;
+    new_color.g = ga + static_cast<uint16_t>(pixel_color.g * a_flip) / 255;
+    new_color.b = ba + static_cast<uint16_t>(pixel_color.b * a_flip) / 255;
+    pixel_color = new_color;
+  }
+};
+
+// Horizontal run of pixels [start, end) within one row of a circle, as offsets
+// from the center x.
+struct Span {
+  int16_t start;
+  int16_t end;
+};
+
+// Lazily built row spans for each pixel radius. Row i of a circle covers
+// y = center_y - radius + i. These match the pixels the distance test
+// (center_x - x)^2 + (center_y - y)^2 <= radius^2 selects over the box
+// [center - radius, center + radius), so no pixel needs testing when drawing.
+class CircleSpans {
+ public:
+  const std::vector<Span> &Get(int radius) {
+    if (radius >= static_cast<int>(spans_.size())) {
+      spans_.resize(radius + 1);
+    }
+    std::vector<Span> &rows = spans_[radius];
+    if (rows.empty()) {
+      rows = Build(radius);
+    }
+    return rows;
+  }
+
+ private:
+  static std::vector<Span> Build(int radius) {
+    std::vector<Span> rows(2 * radius);
+    int r2 = radius * radius;
+    for (int i = 0; i < 2 * radius; ++i) {
+      int dy = radius - i;
+      int max_dx = 0;
+      while ((max_dx + 1) * (max_dx + 1) + dy * dy <= r2) ++max_dx;
+      rows[i] = {
+          .start = static_cast<int16_t>(-max_dx),
+          .end = static_cast<int16_t>(std::min(max_dx, radius - 1) + 1),
+      };
+    }
+    return rows;
+  }
+
+  std::vector<std::vector<Span>> spans_;
+};
+
+inline CircleSpans &circle_spans() {
+  static CircleSpans spans;
+  return spans;
+}
+
+inline void draw_circle(const Canvas &canvas, PixelCircle circle,
+                        Color color) {
+  const auto [center_x, center_y, radius] = circle;
+  BlendColor blend(color);
+
+  const std::vector<Span> &rows = circle_spans().Get(radius);
+  int first_row = std::max(radius - center_y, 0);
+  int last_row = std::min(canvas.height - center_y + radius, 2 * radius);
+  if (canvas.dirty) {
+    canvas.dirty->Mark(std::max(center_x - radius, 0),
+                       center_y - radius + first_row,
+                       std::min(center_x + radius, canvas.width),
+                       center_y - radius + last_row);
+  }
+  for (int i = first_row; i < last_row; ++i) {
+    Color *row = canvas.row(center_y - radius + i);
+    int start = std::max(center_x + rows[i].start, 0);
+    int end = std::min(center_x + rows[i].end, canvas.width);
+    for (int x = start; x < end; ++x) {
+      blend.Apply(row[x]);
+    }
+  }
+}
+
+// Level of detail path for particles that are at most a pixel in radius.
+// They are splatted as the single center pixel instead of the 3 pixel circle.
+inline void draw_point(const Canvas &canvas, PixelCircle circle, Color color) {
+  if (circle.center_x < 0 || circle.center_x >= canvas.width ||
+      circle.center_y < 0 || circle.center_y >= canvas.height) {
+    return;
+  }
+  BlendColor(color).Apply(canvas.row(circle.center_y)[circle.center_x]);
+  if (canvas.dirty) {
+    canvas.dirty->Mark(circle.center_x, circle.center_y, circle.center_x + 1,
+                       circle.center_y + 1);
+  }
+}
+
+// Draws everything in order and returns how many particles were splatted.
+// The loop is compiled per instruction set so the span blends in
+// draw_circle vectorize as wide as the host allows.
+template <typename List>
+int64_t draw_particles(const Canvas &canvas, const List &particles, bool lod) {
+  int64_t splats = 0;
+  dispatch_kernel([&](auto) {
+    for (const auto &to_draw : particles) {
+      PixelCircle circle =
+          to_pixels(canvas, to_draw.x, to_draw.y, to_draw.radius);
+      if (lod && circle.radius == 1) {
+        draw_point(canvas, circle, to_draw.color);
+        ++splats;
+      } else {
+        draw_circle(canvas, circle, to_draw.color);
+      }
+    }
+  });
+  return splats;
+}
+
+struct PixelRect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// An in memory render target. Headless runs hash it and windows upload it
+// to a texture.
+// It keeps track of the tiles drawn to since the last clear and the ones
+// drawn to before that, so a frame only clears what the last one drew and
+// only uploads what changed between them. At sparse scenes that is a small
+// part of the frame.
+class Framebuffer {
+ public:
+  // Everything counts as drawn to start with, so the first upload covers
+  // the whole target whatever it held before.
+  Framebuffer(int width, int height)
+      : width_(width),
+        height_(height),
+        pixels_(width * height),
+        drawn_(width, height),
+        changed_(width, height) {
+    drawn_.MarkAll();
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Bytes between rows, as SDL_UpdateTexture wants.
+  int pitch() const { return width_ * sizeof(Color); }
+  const Color *pixel(int x, int y) const { return &pixels_[y * width_ + x]; }
+
+  Canvas canvas() {
+    return {.pixels = pixels_.data(),
+            .width = width_,
+            .height = height_,
+            .stride = width_,
+            .dirty = &drawn_};
+  }
+
+  // Starts a frame by clearing the tiles the last frame drew to. Those and
+  // everything drawn until the next Clear are what ForEachChanged visits.
+  void Clear() {
+    changed_ = drawn_;
+    drawn_.ForEachRun([&](int column, int row, int columns) {
+      PixelRect rect = TileRect(column, row, columns);
+      for (int y = rect.y; y < rect.y + rect.height; ++y) {
+        std::fill_n(&pixels_[y * width_ + rect.x], rect.width, Color{});
+      }
+    });
+    drawn_.Clear();
+  }
+
+  // Calls f(rect) for each region that may differ from what the frame
+  // before the last Clear held. When most tiles changed it is one rect for
+  // everything, since each upload has a cost of its own.
+  template <typename F>
+  void ForEachChanged(F f) {
+    changed_.Merge(drawn_);
+    const int64_t tiles = changed_.columns() * changed_.rows();
+    if (changed_.count() * 4 >= tiles * 3) {
+      f(PixelRect{.x = 0, .y = 0, .width = width_, .height = height_});
+      return;
+    }
+    changed_.ForEachRun([&](int column, int row, int columns) {
+      f(TileRect(column, row, columns));
+    });
+  }
+
+  // The share of tiles ForEachChanged visited.
+  double changed_fraction() const {
+    return changed_.count() /
+           static_cast<double>(changed_.columns() * changed_.rows());
+  }
+
+  // FNV-1a over the raw pixel bytes.
+  uint64_t Hash() const {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(pixels_.data());
+    for (size_t i = 0; i < pixels_.size() * sizeof(Color); ++i) {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  // Writes a binary PPM (P6) image.
+  bool WritePpm(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out << "P6\n" << width_ << ' ' << height_ << "\n255\n";
+    std::vector<uint8_t> rgb;
+    rgb.reserve(pixels_.size() * 3);
+    for (Color c : pixels_) {
+      rgb.push_back(c.r);
+      rgb.push_back(c.g);
+      rgb.push_back(c.b);
+    }
+    out.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+    return static_cast<bool>(out);
+  }
+
+ private:
+  PixelRect TileRect(int column, int row, int columns) const {
+    const int x = column * DirtyTiles::TILE_SIZE;
+    const int y = row * DirtyTiles::TILE_SIZE;
+    return {.x = x,
+            .y = y,
+            .width = std::min(columns * DirtyTiles::TILE_SIZE, width_ - x),
+            .height = std::min(DirtyTiles::TILE_SIZE, height_ - y)};
+  }
+
+  int width_;
+  int height_;
+  std::vector<Color> pixels_;
+  // Drawn to since the last Clear, and changed since the one before.
+  DirtyTiles drawn_;
+  DirtyTiles changed_;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Recorded host input, so an interactive session can be rerun exactly.
+// A log holds the settings a session started with and every key press with
+// the frame it was applied before. Frames count loop iterations from the
+// start of the session, so loading a snapshot doesn't throw them off. Keys
+// are SDL keycodes. Logs don't hold snapshots, so a session always starts
+// from a fresh world and only loads snapshots it saved itself.
+
+struct InputEvent {
+  int32_t frame;
+  int32_t key;
+};
+
+struct InputLog {
+  uint64_t seed = 0;
+  int32_t max_entities = 0;
+  float spawn_rate = 0.0f;
+  bool lod = false;
+  bool particle_bursts = false;
+  bool lazy_motion = false;
+  bool collisions = false;
+  std::vector<InputEvent> events;
+  // How many frames the session ran.
+  int32_t frames = 0;
+};
+
+// Writes the log as the session goes, so it survives the host being killed.
+class InputRecorder {
+ public:
+  bool Open(const std::string& path, const InputLog& start) {
+    out_.open(path);
+    if (!out_) return false;
+    char spawn_rate[32];
+    std::snprintf(spawn_rate, sizeof(spawn_rate), "%a", start.spawn_rate);
+    out_ << "# ecs-input v1\n"
+         << "seed " << start.seed << '\n'
+         << "max_entities " << start.max_entities << '\n'
+         << "spawn_rate " << spawn_rate << '\n'
+         << "lod " << start.lod << '\n'
+         << "particle_bursts " << start.particle_bursts << '\n'
+         << "lazy_motion " << start.lazy_motion << '\n'
+         << "collisions " << start.collisions << '\n';
+    out_.flush();
+    return static_cast<bool>(out_);
+  }
+
+  void Key(int32_t frame, int32_t key) {
+    out_ << "key " << frame << ' ' << key << '\n';
+    out_.flush();
+  }
+
+  void End(int32_t frames) {
+    out_ << "end " << frames << '\n';
+    out_.flush();
+  }
+
+ private:
+  std::ofstream out_;
+};
+
+inline bool read_input_log(const std::string& path, InputLog& log) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line) || line != "# ecs-input v1") return false;
+  log = InputLog();
+  bool ended = false;
+  std::string key;
+  while (in >> key) {
+    std::string value;
+    if (key == "key") {
+      InputEvent event;
+      if (!(in >> event.frame >> event.key)) return false;
+      log.events.push_back(event);
+      continue;
+    }
+    if (!(in >> value)) return false;
+    if (key == "seed") {
+      log.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (key == "max_entities") {
+      log.max_entities = std::atoi(value.c_str());
+    } else if (key == "spawn_rate") {
+      log.spawn_rate = std::strtof(value.c_str(), nullptr);
+    } else if (key == "lod") {
+      log.lod = value == "1";
+    } else if (key == "particle_bursts") {
+      log.particle_bursts = value == "1";
+    } else if (key == "lazy_motion") {
+      log.lazy_motion = value == "1";
+    } else if (key == "collisions") {
+      log.collisions = value == "1";
+    } else if (key == "end") {
+      log.frames = std::atoi(value.c_str());
+      ended = true;
+    } else {
+      return false;
+    }
+  }
+  // A session that was killed runs until its last key.
+  if (!ended && !log.events.empty()) log.frames = log.events.back().frame + 1;
+  return in.eof();
+}
+
+// Collects per frame times and reports their distribution.
+class FrameStats {
+ public:
+  void Add(double ms) { times_.push_back(ms); }
+
+  void Report(std::ostream& out) const {
+    if (times_.empty()) return;
+    std::vector<double> sorted = times_;
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (double ms : sorted) total += ms;
+    auto percentile = [&](double p) {
+      return sorted[std::min(sorted.size() - 1,
+                             static_cast<size_t>(p * sorted.size()))];
+    };
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "Frame times over %zu frames: mean %.3fms p50 %.3fms "
+                  "p90 %.3fms p99 %.3fms max %.3fms\n",
+                  sorted.size(), total / sorted.size(), percentile(0.5),
+                  percentile(0.9), percentile(0.99), sorted.back());
+    out << line;
+  }
+
+ private:
+  std::vector<double> times_;
+};
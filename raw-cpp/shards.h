@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "thread-pool.h"
+
+// Independent worlds stepped at the same time, one per block of the thread
+// pool. Fireworks never touch each other, so splitting them between worlds
+// doesn't change what the simulation does, only which world runs it.
+// Systems inside a shard run serially since the pool doesn't nest, so each
+// shard keeps its entities on one core for the whole frame.
+// Each shard has its own rng stream and a share of the entity cap, and
+// fireworks are spawned where there is room for them. Shard 0 uses the
+// same stream as an unsharded world, so one shard reproduces it exactly.
+template <typename World>
+class ShardedWorlds {
+ public:
+  using Draws = decltype(std::declval<World&>().Step(0, 0.0f, 0));
+
+  ShardedWorlds(int32_t shards, int32_t max_entities, uint64_t seed,
+                ThreadPool& pool = ThreadPool::Default())
+      : pool_(&pool), spawn_rates_(shards), draws_(shards) {
+    for (int32_t s = 0; s < shards; ++s) {
+      const int32_t max = ShardMax(max_entities, shards, s);
+      worlds_.push_back(s == 0 ? std::make_unique<World>(max, seed)
+                               : std::make_unique<World>(max, seed, s));
+    }
+  }
+
+  int32_t shards() const { return worlds_.size(); }
+  World& shard(int32_t s) { return *worlds_[s]; }
+
+  // For settings that every shard should share.
+  template <typename F>
+  void ForEach(F f) {
+    for (auto& world : worlds_) f(*world);
+  }
+
+  // Splits max as evenly as possible. This clears every shard.
+  void SetMaxEntities(int32_t max) {
+    for (int32_t s = 0; s < shards(); ++s) {
+      worlds_[s]->SetMaxEntities(ShardMax(max, shards(), s));
+    }
+  }
+
+  int32_t max_entities() const {
+    int32_t max = 0;
+    for (const auto& world : worlds_) max += world->max_entities();
+    return max;
+  }
+
+  int32_t size() const {
+    int32_t size = 0;
+    for (const auto& world : worlds_) size += world->size();
+    return size;
+  }
+
+  // Steps every shard and returns everything they draw, shard by shard.
+  // spawn_rate is split in proportion to the room each shard has left, so
+  // a shard near its cap hands its fireworks to the others. When they are
+  // all full it is split evenly, which is the whole rate for one shard.
+  Draws Step(int32_t current_frame, float spawn_rate,
+             int32_t explosion_particles, bool draw = true) {
+    int64_t room = 0;
+    for (int32_t s = 0; s < shards(); ++s) {
+      spawn_rates_[s] = worlds_[s]->max_entities() - worlds_[s]->size();
+      room += spawn_rates_[s];
+    }
+    for (float& rate : spawn_rates_) {
+      rate = room > 0 ? spawn_rate * (rate / room) : spawn_rate / shards();
+    }
+    pool_->Run(shards(), [&](int32_t s) {
+      draws_[s] = worlds_[s]->Step(current_frame, spawn_rates_[s],
+                                   explosion_particles, draw);
+    });
+
+    Draws out;
+    if (!draw) return out;
+    std::vector<size_t> offsets(shards() + 1, 0);
+    for (int32_t s = 0; s < shards(); ++s) {
+      offsets[s + 1] = offsets[s] + draws_[s].size();
+    }
+    out.resize(offsets.back());
+    pool_->Run(shards(), [&](int32_t s) {
+      std::copy(draws_[s].begin(), draws_[s].end(), out.begin() + offsets[s]);
+    });
+    return out;
+  }
+
+ private:
+  static int32_t ShardMax(int32_t max, int32_t shards, int32_t s) {
+    return std::max(1, max / shards + (s < max % shards));
+  }
+
+  ThreadPool* pool_;
+  std::vector<std::unique_ptr<World>> worlds_;
+  std::vector<float> spawn_rates_;
+  std::vector<Draws> draws_;
+};
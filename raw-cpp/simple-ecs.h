@@ -1,10 +1,29 @@
 #include <algorithm>
-#include <bitset>
+#include <array>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <random>
+#include <string>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "arena.h"
+#include "command-buffer.h"
+#include "cpu-dispatch.h"
+#include "memory-stats.h"
 #include "pcg_random.hpp"
+#include "snapshot.h"
+#include "spatial-grid.h"
+#include "thread-pool.h"
 
 // A lot of this library is just done the way it is for simplicity.
 // That is the reason for one header file and systems just built into the
@@ -26,6 +45,40 @@ struct ToDraw {
   float y;
 };
 
+// Controls which entities the graphics system skips instead of emitting.
+// The screen size is only used to map positions and radii to pixels the same
+// way the host does when drawing. A width or height of 0 disables bounds
+// culling.
+struct CullSettings {
+  int32_t width = 0;
+  int32_t height = 0;
+  // An alpha of 0 never changes a pixel, so skipping it is free.
+  uint8_t min_alpha = 1;
+  float min_radius = 0.0f;
+};
+
+// Counts of entities skipped by the graphics system in the last frame.
+struct CullStats {
+  int32_t offscreen = 0;
+  int32_t faded = 0;
+  int32_t too_small = 0;
+
+  int32_t total() const { return offscreen + faded + too_small; }
+};
+
+// True if drawing this would not touch a single pixel on screen.
+inline bool IsOffscreen(const CullSettings& settings, const ToDraw& to_draw) {
+  if (settings.width == 0 || settings.height == 0) return false;
+  int center_x = std::round(to_draw.x * settings.width);
+  int center_y = std::round((1.0 - to_draw.y) * settings.height);
+  int radius = std::max(
+      static_cast<int>(std::round(to_draw.radius *
+                                  (settings.height + settings.width) / 2.0)),
+      1);
+  return center_x + radius <= 0 || center_x - radius >= settings.width ||
+         center_y + radius <= 0 || center_y - radius >= settings.height;
+}
+
 struct CompDeathTime {
   int32_t dead_frame;
 };
@@ -60,6 +113,254 @@ struct CompVelocity {
   float dy;
 };
 
+// A firework that died this frame. Explosions run sorted by this order so the
+// rng is drawn from in the same order no matter how entities are stored.
+struct Explosion {
+  CompPosition position;
+  Color color;
+  int32_t num_particles;
+
+  friend bool operator<(const Explosion& lhs, const Explosion& rhs) {
+    auto key = [](const Explosion& e) {
+      return std::make_tuple(e.position.x, e.position.y, e.color.r, e.color.g,
+                             e.color.b, e.color.a, e.num_particles);
+    };
+    return key(lhs) < key(rhs);
+  }
+};
+
+// Entities a system asks for in a command buffer. They are made when the
+// buffer is played back, since that is where the rng is drawn from, so one
+// record stands for a whole explosion or a frame's fireworks.
+struct NewEntities {
+  enum class Kind : uint8_t {
+    EXPLOSION,
+    FIREWORKS,
+  };
+
+  Kind kind;
+  // For EXPLOSION.
+  Explosion explosion;
+  // For FIREWORKS, as passed to Step.
+  float spawn_rate;
+  int32_t explosion_particles;
+};
+
+// The state of a single live entity in a form that is the same for every ECS.
+// Bit i of components is set for each component present, in the order the
+// fields are listed. Missing components are left zeroed.
+struct EntityState {
+  uint32_t components = 0;
+  CompDeathTime death_time = {};
+  CompFades fades = {};
+  CompExplodes explodes = {};
+  CompGraphics graphics = {};
+  CompPosition position = {};
+  CompVelocity velocity = {};
+};
+
+// Notified around every system that Step runs, e.g. to hash or profile them.
+class SystemObserver {
+ public:
+  virtual ~SystemObserver() = default;
+  virtual void BeforeSystem(const char* /*system*/) {}
+  virtual void AfterSystem(const char* /*system*/) {}
+};
+
+// Movement on the plain float components.
+inline void move(CompPosition& p, CompVelocity v) {
+  p.x += v.dx;
+  p.y += v.dy;
+}
+
+// TODO: Tune the gravity constant.
+constexpr double GRAVITY = 0.0003;
+
+inline void apply_gravity(CompVelocity& v) { v.dy -= GRAVITY; }
+
+// Where steps frames of Move and then Gravity leave an entity that starts at
+// p with velocity v. Move uses each frame's velocity before Gravity changes
+// it, so the drop is g * (0 + 1 + ... + steps - 1).
+inline CompPosition ballistic_position(CompPosition p, CompVelocity v,
+                                       bool gravity, int32_t steps) {
+  double drop = gravity ? GRAVITY * steps * (steps - 1) / 2 : 0.0;
+  return {.x = p.x + v.dx * steps,
+          .y = static_cast<float>(p.y + v.dy * steps - drop)};
+}
+
+inline CompVelocity ballistic_velocity(CompVelocity v, bool gravity,
+                                       int32_t steps) {
+  if (gravity) v.dy = static_cast<float>(v.dy - GRAVITY * steps);
+  return v;
+}
+
+#if defined(COMPACT_COMPONENTS)
+// Compact storage for positions and velocities, used when built with
+// COMPACT_COMPONENTS. Both are 16 bit fixed point. Positions step in 2^-14
+// of the screen and cover [-2, 2), which is well beyond where anything lives.
+// Velocities need finer steps for gravity to add up, so they step in 2^-20
+// and cover about +-0.031 per frame. Values out of range saturate.
+constexpr int32_t POSITION_BITS = 14;
+constexpr int32_t VELOCITY_BITS = 20;
+
+struct PackedPosition {
+  int16_t x;
+  int16_t y;
+};
+
+struct PackedVelocity {
+  int16_t dx;
+  int16_t dy;
+};
+
+inline int16_t saturate_int16(int32_t value) {
+  return std::clamp<int32_t>(value, INT16_MIN, INT16_MAX);
+}
+
+// Scaling by a power of two is exact, so only the rounding loses anything.
+inline int16_t to_fixed(float value, int32_t bits) {
+  return saturate_int16(std::lround(value * static_cast<float>(1 << bits)));
+}
+
+inline float from_fixed(int16_t value, int32_t bits) {
+  return static_cast<float>(value) * (1.0f / static_cast<float>(1 << bits));
+}
+
+inline PackedPosition pack(CompPosition p) {
+  return {.x = to_fixed(p.x, POSITION_BITS), .y = to_fixed(p.y, POSITION_BITS)};
+}
+
+inline CompPosition unpack(PackedPosition p) {
+  return {.x = from_fixed(p.x, POSITION_BITS),
+          .y = from_fixed(p.y, POSITION_BITS)};
+}
+
+inline PackedVelocity pack(CompVelocity v) {
+  return {.dx = to_fixed(v.dx, VELOCITY_BITS),
+          .dy = to_fixed(v.dy, VELOCITY_BITS)};
+}
+
+inline CompVelocity unpack(PackedVelocity v) {
+  return {.dx = from_fixed(v.dx, VELOCITY_BITS),
+          .dy = from_fixed(v.dy, VELOCITY_BITS)};
+}
+
+constexpr int16_t GRAVITY_FIXED =
+    static_cast<int16_t>(GRAVITY * (1 << VELOCITY_BITS) + 0.5);
+
+// Velocity is shifted down to position steps with rounding. Both axes are
+// done at once with saturating 16 bit lanes.
+inline void move(PackedPosition& p, PackedVelocity v) {
+  constexpr int32_t SHIFT = VELOCITY_BITS - POSITION_BITS;
+  constexpr int16_t HALF = 1 << (SHIFT - 1);
+#if defined(__SSE2__)
+  int32_t p_bits;
+  int32_t v_bits;
+  std::memcpy(&p_bits, &p, sizeof(p));
+  std::memcpy(&v_bits, &v, sizeof(v));
+  __m128i step = _mm_srai_epi16(
+      _mm_adds_epi16(_mm_cvtsi32_si128(v_bits), _mm_set1_epi16(HALF)), SHIFT);
+  p_bits = _mm_cvtsi128_si32(_mm_adds_epi16(_mm_cvtsi32_si128(p_bits), step));
+  std::memcpy(&p, &p_bits, sizeof(p));
+#else
+  p.x = saturate_int16(p.x + (saturate_int16(v.dx + HALF) >> SHIFT));
+  p.y = saturate_int16(p.y + (saturate_int16(v.dy + HALF) >> SHIFT));
+#endif
+}
+
+inline void apply_gravity(PackedVelocity& v) {
+  v.dy = saturate_int16(v.dy - GRAVITY_FIXED);
+}
+
+// Every particle of an explosion fades the same way and there are only a few
+// hundred distinct fades, so entities store an index into a table of them.
+// Entry NO_FADE never fades, and fades that don't fit in the table get it.
+class FadesTable {
+ public:
+  static constexpr uint16_t NO_FADE = 0;
+
+  FadesTable() { Clear(); }
+
+  uint16_t Intern(const CompFades& fades) {
+    uint64_t key;
+    std::memcpy(&key, &fades, sizeof(key));
+    auto [it, inserted] = indices_.try_emplace(key, fades_.size());
+    if (inserted) {
+      if (fades_.size() > UINT16_MAX) {
+        indices_.erase(it);
+        return NO_FADE;
+      }
+      fades_.push_back(fades);
+    }
+    return it->second;
+  }
+
+  const CompFades& operator[](uint16_t index) const { return fades_[index]; }
+  const std::vector<CompFades>& entries() const { return fades_; }
+
+  void Clear() {
+    fades_.clear();
+    indices_.clear();
+    Intern({});
+  }
+
+ private:
+  std::vector<CompFades> fades_;
+  std::unordered_map<uint64_t, uint16_t> indices_;
+};
+#endif
+
+// Every particle of an explosion starts at the same place with the same size,
+// color and fades. With particle bursts on that is stored once per explosion
+// and each particle only keeps its direction and how many frames after the
+// rest of the burst it dies. Fade, Move and Gravity then have closed forms in
+// the number of frames since the explosion, so particles are only touched
+// when Graphics draws them.
+constexpr int32_t BURST_UNIT_BITS = 14;
+constexpr int32_t MAX_DEATH_DELAY = 10;
+// Expired bursts' particles are only compacted away once the storage holds
+// more than twice the live ones plus this many.
+constexpr size_t BURST_COMPACT_SLACK = 4096;
+
+// Burst particles count against the entity cap, so at most max are live.
+// Storage left after a compaction check holds at most twice the live ones
+// plus the slack, and the bursts added before the next check only fill the
+// cap back up, so the storage never passes this.
+inline size_t burst_particle_capacity(int32_t max) {
+  return 2 * size_t(max) + BURST_COMPACT_SLACK;
+}
+
+struct BurstParticle {
+  // Unit direction in 2^-BURST_UNIT_BITS steps.
+  int16_t unit_dx;
+  int16_t unit_dy;
+  uint8_t death_delay;
+};
+
+struct ParticleBurst {
+  CompPosition origin;
+  CompGraphics graphics;
+  CompFades fades;
+  float speed;
+  int32_t first_frame;
+  int32_t dead_frame;
+  // The burst's particles in the ECS's burst particle storage.
+  int32_t first;
+  int32_t count;
+};
+
+// The color Fade leaves after running steps times.
+inline Color faded_color(Color c, const CompFades& f, int32_t steps) {
+  if (steps <= 0) return c;
+  auto fade = [steps](uint8_t c, uint8_t min, uint8_t rate) -> uint8_t {
+    return std::max(c - steps * rate, static_cast<int32_t>(min));
+  };
+  return {.b = fade(c.b, f.b_min, f.b_rate),
+          .g = fade(c.g, f.g_min, f.g_rate),
+          .r = fade(c.r, f.r_min, f.r_rate),
+          .a = fade(c.a, f.a_min, f.a_rate)};
+}
+
 class Signiture {
  public:
   static constexpr int32_t IS_ALIVE_INDEX = 0;
@@ -71,6 +372,7 @@ class Signiture {
   static constexpr int32_t VELOCITY_INDEX = 6;
   static constexpr int32_t FEELS_GRAVITY_INDEX = 7;
   static constexpr int32_t COUNT = 8;
+  static_assert(COUNT <= 8, "Signitures are packed into a single byte.");
 
   struct Initializer {
     bool isAlive = false;
@@ -85,113 +387,776 @@ class Signiture {
 
   Signiture() {}
   Signiture(Initializer init) {
-    data_[IS_ALIVE_INDEX] = init.isAlive;
-    data_[DEATH_TIME_INDEX] = init.hasDeathTime;
-    data_[FADES_INDEX] = init.hasFades;
-    data_[EXPLODES_INDEX] = init.hasExplodes;
-    data_[GRAPHICS_INDEX] = init.hasGraphics;
-    data_[POSITION_INDEX] = init.hasPosition;
-    data_[VELOCITY_INDEX] = init.hasVelocity;
-    data_[FEELS_GRAVITY_INDEX] = init.feelsGravity;
+    Set(IS_ALIVE_INDEX, init.isAlive);
+    Set(DEATH_TIME_INDEX, init.hasDeathTime);
+    Set(FADES_INDEX, init.hasFades);
+    Set(EXPLODES_INDEX, init.hasExplodes);
+    Set(GRAPHICS_INDEX, init.hasGraphics);
+    Set(POSITION_INDEX, init.hasPosition);
+    Set(VELOCITY_INDEX, init.hasVelocity);
+    Set(FEELS_GRAVITY_INDEX, init.feelsGravity);
+  }
+
+  static Signiture FromBits(uint8_t bits) {
+    Signiture sig;
+    sig.data_ = bits;
+    return sig;
   }
 
-  bool operator[](size_t x) const { return data_[x]; }
-  std::bitset<COUNT>::reference operator[](size_t x) { return data_[x]; }
+  bool operator[](size_t x) const { return (data_ >> x) & 1; }
+  void Set(size_t x, bool value) {
+    data_ = (data_ & ~(1u << x)) | (static_cast<uint32_t>(value) << x);
+  }
 
-  bool IsAlive() const { return data_[IS_ALIVE_INDEX]; }
+  bool IsAlive() const { return (*this)[IS_ALIVE_INDEX]; }
 
   bool Matches(Signiture other) const {
     return (data_ & other.data_) == other.data_;
   }
 
+  uint8_t bits() const { return data_; }
+
  private:
-  std::bitset<COUNT> data_;
+  uint8_t data_ = 0;
 };
 
-struct Entity {
-  int32_t id;
-  Signiture signiture;
+#if defined(ECS_MULTI_ISA)
+ECS_TARGET_AVX2 inline uint64_t match_mask_64_avx2(const uint8_t* sigs,
+                                                   uint8_t mask,
+                                                   uint8_t value) {
+  const __m256i m = _mm256_set1_epi8(static_cast<char>(mask));
+  const __m256i v = _mm256_set1_epi8(static_cast<char>(value));
+  uint64_t out = 0;
+  for (int i = 0; i < 2; ++i) {
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sigs) + i);
+    __m256i eq = _mm256_cmpeq_epi8(_mm256_and_si256(s, m), v);
+    out |= static_cast<uint64_t>(
+               static_cast<uint32_t>(_mm256_movemask_epi8(eq)))
+           << (32 * i);
+  }
+  return out;
+}
+
+// All 64 at once, straight into a mask register.
+ECS_TARGET_AVX512 inline uint64_t match_mask_64_avx512(const uint8_t* sigs,
+                                                       uint8_t mask,
+                                                       uint8_t value) {
+  const __m512i s = _mm512_loadu_si512(sigs);
+  return _mm512_cmpeq_epi8_mask(
+      _mm512_and_si512(s, _mm512_set1_epi8(static_cast<char>(mask))),
+      _mm512_set1_epi8(static_cast<char>(value)));
+}
+#endif
 
-  bool IsAlive() { return signiture.IsAlive(); }
-  bool Matches(Signiture other) const { return signiture.Matches(other); }
-};
+// Returns a mask with bit i set when (sigs[i] & mask) == value, for the 64
+// signitures starting at sigs.
+inline uint64_t match_mask_64(const uint8_t* sigs, uint8_t mask,
+                              uint8_t value) {
+#if defined(__AVX2__) && defined(ECS_MULTI_ISA)
+  return match_mask_64_avx2(sigs, mask, value);
+#elif defined(__SSE2__)
+  const __m128i m = _mm_set1_epi8(static_cast<char>(mask));
+  const __m128i v = _mm_set1_epi8(static_cast<char>(value));
+  uint64_t out = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sigs) + i);
+    __m128i eq = _mm_cmpeq_epi8(_mm_and_si128(s, m), v);
+    out |= static_cast<uint64_t>(
+               static_cast<uint16_t>(_mm_movemask_epi8(eq)))
+           << (16 * i);
+  }
+  return out;
+#else
+  uint64_t out = 0;
+  for (int i = 0; i < 64; ++i) {
+    out |= static_cast<uint64_t>((sigs[i] & mask) == value) << i;
+  }
+  return out;
+#endif
+}
+
+// match_mask_64 with the widest compare isa has.
+template <Isa isa>
+inline uint64_t match_mask_64(IsaConstant<isa>, const uint8_t* sigs,
+                              uint8_t mask, uint8_t value) {
+#if defined(ECS_MULTI_ISA)
+  if constexpr (isa == Isa::kAvx512) {
+    return match_mask_64_avx512(sigs, mask, value);
+  } else if constexpr (isa == Isa::kAvx2) {
+    return match_mask_64_avx2(sigs, mask, value);
+  }
+#endif
+  return match_mask_64(sigs, mask, value);
+}
+
+// Returns how many elements of a are in the first `diagonal` elements of the
+// merge of sorted a and b. Lets a merge be split into independent pieces.
+inline int32_t merge_path_split(const int32_t* a, int32_t a_size,
+                                const int32_t* b, int32_t b_size,
+                                int32_t diagonal) {
+  int32_t lo = std::max(0, diagonal - b_size);
+  int32_t hi = std::min(diagonal, a_size);
+  while (lo < hi) {
+    int32_t i = lo + (hi - lo) / 2;
+    if (a[i] < b[diagonal - i - 1]) {
+      lo = i + 1;
+    } else {
+      hi = i;
+    }
+  }
+  return lo;
+}
 
 class ECS {
+  // The system benchmarks build worlds and run single systems directly.
+  friend class SystemBench;
+
+#if defined(COMPACT_COMPONENTS)
+  static constexpr const char* SNAPSHOT_NAME = "simple-ecs-live-compact";
+#else
+  static constexpr const char* SNAPSHOT_NAME = "simple-ecs-live";
+#endif
+
  public:
   explicit ECS(int32_t max)
       : rng_(pcg_extras::seed_seq_from<std::random_device>()) {
     SetMaxEntities(max);
   }
 
+  // A fixed seed makes every run with the same inputs identical.
+  ECS(int32_t max, uint64_t seed) : rng_(seed) { SetMaxEntities(max); }
+
+  // Worlds with the same seed and different streams draw unrelated numbers.
+  ECS(int32_t max, uint64_t seed, uint64_t stream) : rng_(seed, stream) {
+    SetMaxEntities(max);
+  }
+
   // This will clear all current entities.
+  // The component storage comes from the PageArena and is left
+  // uninitialized, so only ids and signitures are written here.
   void SetMaxEntities(int32_t max) {
-    entities_.resize(max);
-    death_time_.resize(max);
-    fades_.resize(max);
-    explodes_.resize(max);
-    graphics_.resize(max);
-    position_.resize(max);
-    velocity_.resize(max);
+    // Cleared first so growing doesn't copy entities that are thrown away.
+    auto reset = [max](auto& vec) {
+      vec.clear();
+      vec.resize(max);
+    };
+    reset(ids_);
+    reset(scratch_ids_);
+    reset(scratch_signitures_);
+    // Padded so match masks can read 64 signitures from any index below max.
+    signitures_.assign((max + 63) / 64 * 64 + 64, 0);
+    reset(death_time_);
+    reset(fades_);
+    reset(explodes_);
+    reset(graphics_);
+    reset(position_);
+    reset(velocity_);
+    reset(motion_frame_);
+#if defined(COMPACT_COMPONENTS)
+    fades_table_.Clear();
+#endif
+    bursts_.clear();
+    burst_particles_.clear();
+    burst_particles_.reserve(burst_particle_capacity(max));
+    burst_particle_count_ = 0;
     size_ = 0;
     new_size_ = 0;
     max_ = max;
+    signiture_counts_.fill(0);
     for (int32_t i = 0; i < max; ++i) {
-      entities_[i].id = i;
-      entities_[i].signiture = Signiture();
+      ids_[i] = i;
     }
   }
 
+  // Graphics is skipped and nothing is returned unless draw is set.
   std::vector<ToDraw> Step(int32_t current_frame, float spawn_rate,
-                           int32_t explosion_particles) {
-    RunDeathSystem(current_frame);
-    RunExplodesSystem(current_frame);
-    RunFadeSystem();
-    RunMoveSystem();
-    RunGravitySystem();
-    RunSpawnSystem(current_frame, spawn_rate, explosion_particles);
-    Refresh();
-    return RunGraphicsSystem();
+                           int32_t explosion_particles, bool draw = true) {
+    current_frame_ = current_frame;
+    Observe("Death", [&] { RunDeathSystem(current_frame); });
+    Observe("Explodes", [&] { RunExplodesSystem(current_frame); });
+    Observe("Fade", [&] { RunFadeSystem(); });
+    Observe("Move", [&] { RunMoveSystem(); });
+    Observe("Gravity", [&] { RunGravitySystem(); });
+    if (collisions_) Observe("Collision", [&] { RunCollisionSystem(); });
+    Observe("Spawn", [&] {
+      RunSpawnSystem(current_frame, spawn_rate, explosion_particles);
+    });
+    Observe("Refresh", [&] { Refresh(); });
+    std::vector<ToDraw> out;
+    if (draw) Observe("Graphics", [&] { out = RunGraphicsSystem(); });
+    return out;
+  }
+
+  // Burst particles count as entities until their whole burst is gone.
+  int32_t size() { return size_ + burst_particle_count_; }
+
+  // Explosions from now on store their particles as bursts instead of as
+  // entities. Bursts that already exist keep going either way.
+  void SetParticleBursts(bool enabled) { particle_bursts_ = enabled; }
+  bool particle_bursts() const { return particle_bursts_; }
+
+  // With lazy motion Move and Gravity don't run. Entities keep the position
+  // and velocity they had in the frame they started moving and both are
+  // worked out from the number of frames since whenever they are read.
+  // Summing the same velocity every frame rounds differently, but the two
+  // stay within a few millionths of the screen over 600 frames.
+  // Switching either way rebases every moving entity on where it is now.
+  void SetLazyMotion(bool enabled) {
+    if (enabled == lazy_motion_) return;
+    Signiture sig({.isAlive = true, .hasPosition = true, .hasVelocity = true});
+    ForEachMatch(sig, new_size_, [&](int32_t i) {
+      int32_t id = ids_[i];
+      if (lazy_motion_) {
+        CompPosition p = PositionAt(i, current_frame_);
+        SetVelocity(id, VelocityAt(i, current_frame_));
+        SetPosition(id, p);
+      }
+      motion_frame_[id] = current_frame_ + 1;
+    });
+    lazy_motion_ = enabled;
+  }
+  bool lazy_motion() const { return lazy_motion_; }
+
+  // With collisions explosion particles bounce off the bottom of the screen
+  // and off each other. Burst particles don't collide.
+  void SetCollisions(bool enabled) { collisions_ = enabled; }
+  bool collisions() const { return collisions_; }
+
+  int32_t max_entities() const { return max_; }
+
+  // Caps how many entities spawns and explosions may create, below
+  // max_entities, without clearing anything. Entities over the budget
+  // live out their lives; it only stops new ones.
+  void SetEntityBudget(int32_t budget) { entity_budget_ = budget; }
+  int32_t entity_budget() const { return EntityCap(); }
+
+  // Every column is sized for max entities whether they exist or not, so
+  // this shows how much of each is holding live entities. Burst particles
+  // aren't in the component columns. Call between frames.
+  MemoryStats GetMemoryStats() const {
+    MemoryStats stats;
+    stats.live = size_ + burst_particle_count_;
+    stats.capacity = max_;
+    auto add = [&](const char* name, const auto& vector, int64_t live) {
+      stats.Add(stats.components, vector_usage(name, vector, live));
+      stats.resident_bytes += PageArena::ResidentBytes(
+          vector.data(), stats.components.back().reserved_bytes);
+    };
+    auto with = [&](int32_t index) {
+      int64_t count = 0;
+      for (int32_t bits = 0; bits < 256; ++bits) {
+        if (bits >> index & 1) count += signiture_counts_[bits];
+      }
+      return count;
+    };
+    add("death_time", death_time_, with(Signiture::DEATH_TIME_INDEX));
+    add("fades", fades_, with(Signiture::FADES_INDEX));
+#if defined(COMPACT_COMPONENTS)
+    add("fades_table", fades_table_.entries(), fades_table_.entries().size());
+#endif
+    add("explodes", explodes_, with(Signiture::EXPLODES_INDEX));
+    add("graphics", graphics_, with(Signiture::GRAPHICS_INDEX));
+    add("position", position_, with(Signiture::POSITION_INDEX));
+    add("velocity", velocity_, with(Signiture::VELOCITY_INDEX));
+    add("motion_frame", motion_frame_, with(Signiture::POSITION_INDEX));
+    add("ids", ids_, size_);
+    add("signitures", signitures_, size_);
+    add("scratch_ids", scratch_ids_, size_);
+    add("scratch_signitures", scratch_signitures_, size_);
+    add("burst_particles", burst_particles_, burst_particle_count_);
+    stats.SetArena(PageArena::Default());
+    return stats;
+  }
+
+  // Gives back memory the world isn't using: column capacity left from a
+  // larger entity cap, the pages of each column that only hold entities
+  // without that component or free ids, scratch space for systems that are
+  // off and blocks the PageArena kept for reuse. It is all faulted back in,
+  // zeroed, once it is used again. Returns the bytes given back. Call
+  // between frames.
+  size_t ReleaseUnusedMemory() {
+    size_t released = 0;
+    // Live ids are sorted, so the pages a column needs are found in one
+    // pass and everything between them goes.
+    auto release = [&](auto& column, int32_t index) {
+      using T = typename std::decay_t<decltype(column)>::value_type;
+      column.shrink_to_fit();
+      uint8_t* data = reinterpret_cast<uint8_t*>(column.data());
+      size_t needed_to = 0;
+      for (int32_t i = 0; i < size_; ++i) {
+        if (!Signiture::FromBits(signitures_[i])[index]) continue;
+        const size_t begin = size_t(ids_[i]) * sizeof(T);
+        if (begin > needed_to) {
+          released += PageArena::ReleasePages(data + needed_to,
+                                              begin - needed_to);
+        }
+        needed_to = std::max(needed_to, begin + sizeof(T));
+      }
+      released += PageArena::ReleasePages(
+          data + needed_to, column.capacity() * sizeof(T) - needed_to);
+    };
+    release(death_time_, Signiture::DEATH_TIME_INDEX);
+    release(fades_, Signiture::FADES_INDEX);
+    release(explodes_, Signiture::EXPLODES_INDEX);
+    release(graphics_, Signiture::GRAPHICS_INDEX);
+    release(position_, Signiture::POSITION_INDEX);
+    release(velocity_, Signiture::VELOCITY_INDEX);
+    release(motion_frame_, Signiture::POSITION_INDEX);
+    ids_.shrink_to_fit();
+    signitures_.shrink_to_fit();
+    scratch_ids_.shrink_to_fit();
+    scratch_signitures_.shrink_to_fit();
+    if (burst_particles_.capacity() > burst_particle_capacity(max_)) {
+      ArenaVector<BurstParticle> burst_particles;
+      burst_particles.reserve(burst_particle_capacity(max_));
+      burst_particles.assign(burst_particles_.begin(), burst_particles_.end());
+      burst_particles_.swap(burst_particles);
+    }
+    const size_t burst_bytes = burst_particles_.size() * sizeof(BurstParticle);
+    released += PageArena::ReleasePages(
+        reinterpret_cast<uint8_t*>(burst_particles_.data()) + burst_bytes,
+        burst_particles_.capacity() * sizeof(BurstParticle) - burst_bytes);
+    auto free_vector = [](auto& vector) {
+      vector.clear();
+      vector.shrink_to_fit();
+    };
+    free_vector(explosions_);
+    free_vector(fireworks_);
+    free_vector(refresh_new_);
+    if (!collisions_) {
+      free_vector(collision_bodies_);
+      free_vector(collision_indices_);
+      collision_grid_ = SpatialGrid<CollisionBody>(2 * COLLISION_RADIUS);
+    }
+    return released + PageArena::Default().ReleaseFree();
   }
 
-  int32_t size() { return size_; }
+  // Writes the whole world to a snapshot, between frames. frame is the last
+  // frame stepped.
+  // Only the new_size_ entities in use are written, with their components
+  // gathered in index order. Refresh orders new entities by id, so ids_ is
+  // kept too, up to the last slot that isn't still its own id.
+  bool Save(const std::string& path, int32_t frame) const {
+    SnapshotWriter writer(SNAPSHOT_NAME, frame);
+    int32_t ids_end = max_;
+    while (ids_end > new_size_ && ids_[ids_end - 1] == ids_end - 1) --ids_end;
+    // The writer doesn't copy, so the gathered columns live until Write.
+    std::vector<std::vector<uint8_t>> live;
+    live.reserve(7);
+    auto add_live = [&](const char* name, const auto& column) {
+      const size_t bytes = sizeof(column[0]);
+      std::vector<uint8_t>& rows = live.emplace_back(new_size_ * bytes);
+      for (int32_t i = 0; i < new_size_; ++i) {
+        std::memcpy(rows.data() + i * bytes, &column[ids_[i]], bytes);
+      }
+      writer.AddVector(name, rows);
+    };
+    writer.AddValue("max", max_);
+    writer.AddValue("size", size_);
+    writer.AddValue("new_size", new_size_);
+    writer.AddVector("signiture_counts", signiture_counts_);
+    writer.Add("ids", ids_.data(), ids_end * sizeof(ids_[0]));
+    writer.Add("signitures", signitures_.data(),
+               new_size_ * sizeof(signitures_[0]));
+    add_live("death_time", death_time_);
+    add_live("fades", fades_);
+    add_live("explodes", explodes_);
+    add_live("graphics", graphics_);
+    add_live("position", position_);
+    add_live("velocity", velocity_);
+    add_live("motion_frame", motion_frame_);
+#if defined(COMPACT_COMPONENTS)
+    writer.AddVector("fades_table", fades_table_.entries());
+#endif
+    writer.AddVector("bursts", bursts_);
+    writer.AddVector("burst_particles", burst_particles_);
+    writer.AddValue("particle_bursts", particle_bursts_);
+    writer.AddValue("lazy_motion", lazy_motion_);
+    writer.AddStreamed("rng", rng_);
+    return writer.Write(path);
+  }
+
+  // Replaces the world with a snapshot from Save and sets frame to the frame
+  // it was saved after. On failure the world is left empty with its old cap.
+  bool Load(const std::string& path, int32_t& frame) {
+    const int32_t previous_max = max_;
+    SnapshotReader reader;
+    int32_t max;
+    if (!reader.Open(path) || reader.ecs() != SNAPSHOT_NAME ||
+        !reader.ReadValue("max", max) || max < 0) {
+      SetMaxEntities(previous_max);
+      return false;
+    }
+    // Slots past the saved ids are left as their own ids.
+    SetMaxEntities(max);
+    auto read_ids = [&]() {
+      size_t bytes;
+      if (reader.Find("ids", bytes) == nullptr) return false;
+      const size_t count = bytes / sizeof(ids_[0]);
+      if (bytes % sizeof(ids_[0]) != 0 || count < size_t(new_size_) ||
+          count > size_t(max_) || !reader.Read("ids", ids_.data(), bytes)) {
+        return false;
+      }
+      return std::all_of(ids_.begin(), ids_.begin() + count,
+                         [&](int32_t id) { return 0 <= id && id < max_; });
+    };
+    auto read_live = [&](const char* name, auto& column) {
+      const size_t bytes = sizeof(column[0]);
+      size_t found_bytes;
+      const uint8_t* rows = reader.Find(name, found_bytes);
+      if (rows == nullptr || found_bytes != new_size_ * bytes) return false;
+      for (int32_t i = 0; i < new_size_; ++i) {
+        std::memcpy(&column[ids_[i]], rows + i * bytes, bytes);
+      }
+      return true;
+    };
+    bool ok = reader.ReadValue("size", size_) &&
+              reader.ReadValue("new_size", new_size_) && 0 <= size_ &&
+              size_ <= new_size_ && new_size_ <= max_ &&
+              reader.ReadVector("signiture_counts", signiture_counts_) &&
+              read_ids() &&
+              reader.Read("signitures", signitures_.data(),
+                          new_size_ * sizeof(signitures_[0])) &&
+              read_live("death_time", death_time_) &&
+              read_live("fades", fades_) &&
+              read_live("explodes", explodes_) &&
+              read_live("graphics", graphics_) &&
+              read_live("position", position_) &&
+              read_live("velocity", velocity_) &&
+              read_live("motion_frame", motion_frame_) &&
+              reader.ReadResized("bursts", bursts_) &&
+              reader.ReadResized("burst_particles", burst_particles_) &&
+              reader.ReadValue("particle_bursts", particle_bursts_) &&
+              reader.ReadValue("lazy_motion", lazy_motion_) &&
+              reader.ReadStreamed("rng", rng_);
+#if defined(COMPACT_COMPONENTS)
+    std::vector<CompFades> fades_table;
+    ok = ok && reader.ReadResized("fades_table", fades_table);
+    // Interning in order gives every entry its old index back.
+    for (const CompFades& fades : fades_table) fades_table_.Intern(fades);
+#endif
+    if (!ok) {
+      SetMaxEntities(previous_max);
+      return false;
+    }
+    for (const ParticleBurst& burst : bursts_) {
+      burst_particle_count_ += burst.count;
+    }
+    frame = reader.frame();
+    current_frame_ = frame;
+    return true;
+  }
+
+  // The observer must outlive the ECS or be reset to nullptr.
+  void SetSystemObserver(SystemObserver* observer) { observer_ = observer; }
+
+  // Calls f with the EntityState of every live entity in no particular order.
+  template <typename F>
+  void ForEachLiveEntity(F f) const {
+    for (int32_t i = 0; i < new_size_; ++i) {
+      Signiture sig = Signiture::FromBits(signitures_[i]);
+      if (!sig.IsAlive()) continue;
+      EntityState state;
+      auto copy = [&](int32_t sig_index, auto& field, const auto& vec) {
+        if (sig[sig_index]) {
+          state.components |= 1u << (sig_index - Signiture::DEATH_TIME_INDEX);
+          field = vec[ids_[i]];
+        }
+      };
+      copy(Signiture::DEATH_TIME_INDEX, state.death_time, death_time_);
+      if (sig[Signiture::FADES_INDEX]) {
+        state.components |=
+            1u << (Signiture::FADES_INDEX - Signiture::DEATH_TIME_INDEX);
+        state.fades = GetFades(ids_[i]);
+      }
+      copy(Signiture::EXPLODES_INDEX, state.explodes, explodes_);
+      copy(Signiture::GRAPHICS_INDEX, state.graphics, graphics_);
+      if (sig[Signiture::POSITION_INDEX]) {
+        state.components |=
+            1u << (Signiture::POSITION_INDEX - Signiture::DEATH_TIME_INDEX);
+        state.position = PositionAt(i, current_frame_);
+      }
+      if (sig[Signiture::VELOCITY_INDEX]) {
+        state.components |=
+            1u << (Signiture::VELOCITY_INDEX - Signiture::DEATH_TIME_INDEX);
+        state.velocity = VelocityAt(i, current_frame_);
+      }
+      if (sig[Signiture::FEELS_GRAVITY_INDEX]) {
+        state.components |= 1u << (Signiture::FEELS_GRAVITY_INDEX -
+                                   Signiture::DEATH_TIME_INDEX);
+      }
+      f(state);
+    }
+    // Burst particles as they are at the end of the current frame.
+    const uint32_t burst_components =
+        Signiture({.hasDeathTime = true,
+                   .hasFades = true,
+                   .hasGraphics = true,
+                   .hasPosition = true,
+                   .hasVelocity = true,
+                   .feelsGravity = true})
+            .bits() >>
+        Signiture::DEATH_TIME_INDEX;
+    for (const ParticleBurst& burst : bursts_) {
+      const int32_t steps = current_frame_ - burst.first_frame + 1;
+      const float scale = burst.speed / (1 << BURST_UNIT_BITS);
+      for (int32_t i = 0; i < burst.count; ++i) {
+        const BurstParticle& p = burst_particles_[burst.first + i];
+        const int32_t dead_frame = burst.dead_frame + p.death_delay;
+        if (current_frame_ >= dead_frame) continue;
+        EntityState state;
+        state.components = burst_components;
+        state.death_time = {.dead_frame = dead_frame};
+        state.fades = burst.fades;
+        state.graphics = {
+            .color = faded_color(burst.graphics.color, burst.fades, steps),
+            .radius = burst.graphics.radius};
+        state.velocity = {.dx = p.unit_dx * scale,
+                          .dy = static_cast<float>(p.unit_dy * scale -
+                                                   GRAVITY * steps)};
+        state.position = {
+            .x = burst.origin.x + state.velocity.dx * steps,
+            .y = static_cast<float>(burst.origin.y +
+                                    p.unit_dy * scale * steps -
+                                    GRAVITY * steps * (steps - 1) / 2)};
+        f(state);
+      }
+    }
+  }
+
+  void SetCullSettings(CullSettings settings) { cull_ = settings; }
+  const CullStats& cull_stats() const { return cull_stats_; }
 
  private:
+  // Commands refer to entities by their index in ids_ and signitures_.
+  using Commands = CommandBuffers<int32_t, EntityState, NewEntities>;
+
+  template <typename F>
+  void Observe(const char* system, F run) {
+    if (observer_ == nullptr) {
+      run();
+      return;
+    }
+    observer_->BeforeSystem(system);
+    run();
+    observer_->AfterSystem(system);
+  }
+
+  // Calls f(i) in order for every index i in [begin, end) whose signiture
+  // has all of the components in sig and none of those in excluded. begin
+  // must be a multiple of 64. Signitures are compared 64 at a time and only
+  // the matches are visited.
+  template <typename F>
+  void ForEachMatch(Signiture sig, Signiture excluded, int32_t begin,
+                    int32_t end, F f) {
+    const uint8_t mask = sig.bits() | excluded.bits();
+    const uint8_t value = sig.bits();
+    if (!AnyMatches(mask, value)) return;
+    const uint8_t* sigs = signitures_.data();
+    // Every system's loop goes through here, so this compiles it, f and
+    // all, once per instruction set.
+    dispatch_kernel([&](auto isa) {
+      for (int32_t base = begin; base < end; base += 64) {
+        uint64_t matches = match_mask_64(isa, sigs + base, mask, value);
+        if (end - base < 64) matches &= (uint64_t(1) << (end - base)) - 1;
+        while (matches != 0) {
+          f(base + __builtin_ctzll(matches));
+          matches &= matches - 1;
+        }
+      }
+    });
+  }
+
+  template <typename F>
+  void ForEachMatch(Signiture sig, Signiture excluded, int32_t end, F f) {
+    ForEachMatch(sig, excluded, 0, end, f);
+  }
+
+  template <typename F>
+  void ForEachMatch(Signiture sig, int32_t end, F f) {
+    ForEachMatch(sig, Signiture(), 0, end, f);
+  }
+
+  // Whether any entity below new_size_ could match. This lets systems skip
+  // their scan entirely, e.g. Explodes on frames where nothing died.
+  bool AnyMatches(uint8_t mask, uint8_t value) const {
+    for (int32_t bits = 0; bits < 256; ++bits) {
+      if ((bits & mask) == value && signiture_counts_[bits] != 0) return true;
+    }
+    return false;
+  }
+
+  void SetSigniture(int32_t index, Signiture sig) {
+    --signiture_counts_[signitures_[index]];
+    ++signiture_counts_[sig.bits()];
+    signitures_[index] = sig.bits();
+  }
+
   // This actually adds all of the new entities into the active list.
   // It also remove old dead entites.
+  // Active entities are kept sorted by id so systems walk the component
+  // vectors in order. Survivors are compacted in order with a prefix sum over
+  // blocks, the few new entities are sorted, and then the two runs are merged.
+  // Both passes are split into blocks that run on the thread pool.
   void Refresh() {
-    int32_t i = 0;
-    int32_t j = new_size_ - 1;
-    while (i <= j) {
-      while (i < max_ && entities_[i].IsAlive()) ++i;
-      if (i == max_ || i >= j) break;
-      while (!entities_[j].IsAlive()) --j;
-      if (i >= j) break;
-      std::swap(entities_[i], entities_[j]);
+    constexpr int32_t BLOCK_SIZE = 1 << 14;
+    refresh_blocks_.clear();
+    auto add_blocks = [&](int32_t begin, int32_t end) {
+      for (; begin < end; begin += BLOCK_SIZE) {
+        refresh_blocks_.push_back(
+            {.begin = begin, .end = std::min(begin + BLOCK_SIZE, end)});
+      }
+    };
+    add_blocks(0, size_);
+    const size_t active_blocks = refresh_blocks_.size();
+    add_blocks(size_, new_size_);
+
+    pool_->Run(refresh_blocks_.size(), [&](int32_t b) {
+      RefreshBlock& block = refresh_blocks_[b];
+      int32_t alive = 0;
+      for (int32_t i = block.begin; i < block.end; ++i) {
+        alive += Signiture::FromBits(signitures_[i]).IsAlive();
+      }
+      block.alive = alive;
+    });
+    int32_t alive = 0;
+    int32_t active_alive = 0;
+    for (size_t b = 0; b < refresh_blocks_.size(); ++b) {
+      refresh_blocks_[b].alive_out = alive;
+      alive += refresh_blocks_[b].alive;
+      if (b + 1 == active_blocks) active_alive = alive;
+    }
+    int32_t dead = alive;
+    for (RefreshBlock& block : refresh_blocks_) {
+      block.dead_out = dead;
+      dead += block.end - block.begin - block.alive;
+    }
+
+    // Nothing active died and nothing new lived, so all that is left in
+    // order already.
+    if (active_alive == size_ && alive == size_) {
+      new_size_ = size_;
+      ClearDeadSignitureCounts();
+      return;
+    }
+
+    pool_->Run(refresh_blocks_.size(), [&](int32_t b) {
+      const RefreshBlock& block = refresh_blocks_[b];
+      int32_t alive_out = block.alive_out;
+      int32_t dead_out = block.dead_out;
+      const uint8_t alive_bit = Signiture({.isAlive = true}).bits();
+      auto copy_alive = [&](int32_t from, int32_t count) {
+        std::copy_n(&ids_[from], count, &scratch_ids_[alive_out]);
+        std::copy_n(&signitures_[from], count, &scratch_signitures_[alive_out]);
+        alive_out += count;
+      };
+      // Few entities die each frame, so copy the runs of live ones between
+      // them, 64 signitures at a time.
+      for (int32_t base = block.begin; base < block.end; base += 64) {
+        const int32_t count = std::min(64, block.end - base);
+        uint64_t dead =
+            ~match_mask_64(&signitures_[base], alive_bit, alive_bit);
+        if (count < 64) dead &= (uint64_t(1) << count) - 1;
+        int32_t next = 0;
+        while (dead != 0) {
+          int32_t d = __builtin_ctzll(dead);
+          copy_alive(base + next, d - next);
+          scratch_ids_[dead_out++] = ids_[base + d];
+          next = d + 1;
+          dead &= dead - 1;
+        }
+        copy_alive(base + next, count - next);
+      }
+    });
+
+    // New entities take whatever ids were freed up, so they need sorting.
+    int32_t* new_ids = scratch_ids_.data() + active_alive;
+    const int32_t new_alive = alive - active_alive;
+    if (!std::is_sorted(new_ids, new_ids + new_alive)) {
+      uint8_t* new_signitures = scratch_signitures_.data() + active_alive;
+      // Sorted as single keys with the signiture in the low byte.
+      refresh_new_.resize(new_alive);
+      for (int32_t i = 0; i < new_alive; ++i) {
+        refresh_new_[i] = uint64_t(new_ids[i]) << 8 | new_signitures[i];
+      }
+      std::sort(refresh_new_.begin(), refresh_new_.end());
+      for (int32_t i = 0; i < new_alive; ++i) {
+        new_ids[i] = refresh_new_[i] >> 8;
+        new_signitures[i] = refresh_new_[i] & 0xff;
+      }
     }
-    size_ = i;
-    new_size_ = i;
-    // Having entities sorted seems to have no difference on performance.
-    // std::sort(entities_.begin(), entities_.begin() + size_,
-    //                    [](Entity a, Entity b) { return a.id < b.id; });
+
+    const int32_t* active_ids = scratch_ids_.data();
+    pool_->Run((alive + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](int32_t b) {
+      int32_t out = b * BLOCK_SIZE;
+      const int32_t out_end = std::min(out + BLOCK_SIZE, alive);
+      int32_t i = merge_path_split(active_ids, active_alive, new_ids, new_alive,
+                                   out);
+      int32_t j = out - i;
+      while (out < out_end) {
+        // Copy the run of active entities before the next new one.
+        const int32_t* run_end = std::lower_bound(
+            active_ids + i,
+            active_ids + std::min(active_alive, i + (out_end - out)),
+            j < new_alive ? new_ids[j] : std::numeric_limits<int32_t>::max());
+        const int32_t run = run_end - (active_ids + i);
+        std::copy_n(&scratch_ids_[i], run, &ids_[out]);
+        std::copy_n(&scratch_signitures_[i], run, &signitures_[out]);
+        i += run;
+        out += run;
+        if (out < out_end && j < new_alive) {
+          ids_[out] = new_ids[j];
+          signitures_[out] = scratch_signitures_[active_alive + j];
+          ++j;
+          ++out;
+        }
+      }
+    });
+    // The freed ids go right after the live ones to be reused first.
+    std::copy(scratch_ids_.begin() + alive, scratch_ids_.begin() + new_size_,
+              ids_.begin() + alive);
+
+    size_ = alive;
+    new_size_ = alive;
+    ClearDeadSignitureCounts();
   }
 
-  Entity* AddEntity() {
-    if (new_size_ < max_) {
-      Entity* e = &entities_[new_size_];
-      e->signiture = Signiture();
-      ++new_size_;
-      return e;
+  // Everything below new_size_ is alive after a Refresh.
+  void ClearDeadSignitureCounts() {
+    for (int32_t bits = 0; bits < 256; ++bits) {
+      if (!Signiture::FromBits(bits).IsAlive()) signiture_counts_[bits] = 0;
     }
-    return nullptr;
   }
 
+  // Returns the index of the new entity in ids_ and signitures_, or -1 if
+  // there is no room. The index is only valid until the next Refresh.
+  int32_t AddEntity() {
+    if (new_size_ + burst_particle_count_ < EntityCap()) {
+      signitures_[new_size_] = 0;
+      ++signiture_counts_[0];
+      return new_size_++;
+    }
+    return -1;
+  }
+
+  // A frame's fireworks are one record, since they all draw from the rng.
   void RunSpawnSystem(int32_t current_frame, float spawn_rate,
                       int32_t explosion_particles) {
+    commands_.Reset(1);
+    commands_[0].Create({.kind = NewEntities::Kind::FIREWORKS,
+                         .explosion = {},
+                         .spawn_rate = spawn_rate,
+                         .explosion_particles = explosion_particles});
+    PlayBackCommands(current_frame);
+  }
+
+  void AddFireworks(int32_t current_frame, float spawn_rate,
+                    int32_t explosion_particles) {
     auto spawn_entity = [&]() -> bool {
-      Entity* e = AddEntity();
-      if (e == nullptr) return false;
+      int32_t index = AddEntity();
+      if (index < 0) return false;
 
-      int32_t id = e->id;
+      int32_t id = ids_[index];
       float rise_speed =
           std::uniform_real_distribution<float>(0.01, 0.025)(rng_);
       float frames_to_cross_screen = 1.0 / rise_speed;
@@ -211,14 +1176,16 @@ class ECS {
                        .radius = 0.02};
 
       float x = std::uniform_real_distribution<float>(0.05, 0.95)(rng_);
-      position_[id] = {.x = x, .y = 0.0};
-      velocity_[id] = {.dy = rise_speed};
-      e->signiture = Signiture({.isAlive = true,
-                                .hasDeathTime = true,
-                                .hasExplodes = true,
-                                .hasGraphics = true,
-                                .hasPosition = true,
-                                .hasVelocity = true});
+      SetPosition(id, {.x = x, .y = 0.0});
+      SetVelocity(id, {.dy = rise_speed});
+      // Move has already run this frame.
+      motion_frame_[id] = current_frame + 1;
+      SetSigniture(index, Signiture({.isAlive = true,
+                                     .hasDeathTime = true,
+                                     .hasExplodes = true,
+                                     .hasGraphics = true,
+                                     .hasPosition = true,
+                                     .hasVelocity = true}));
       return true;
     };
     int guaranteed_spawns = static_cast<int>(spawn_rate);
@@ -232,191 +1199,520 @@ class ECS {
   }
 
   void RunDeathSystem(int32_t current_frame) {
+    constexpr int32_t BLOCK_SIZE = 1 << 14;
     Signiture sig({.isAlive = true, .hasDeathTime = true});
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (e.Matches(sig)) {
-        e.signiture[Signiture::IS_ALIVE_INDEX] =
-            current_frame < death_time_[e.id].dead_frame;
+    const int32_t blocks = (size_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    commands_.Reset(blocks);
+    pool_->Run(blocks, [&](int32_t b) {
+      const int32_t end = std::min(size_, (b + 1) * BLOCK_SIZE);
+      ForEachMatch(sig, Signiture(), b * BLOCK_SIZE, end, [&](int32_t i) {
+        if (current_frame >= death_time_[ids_[i]].dead_frame) {
+          commands_[b].Destroy(i);
+        }
+      });
+    });
+    PlayBackCommands(current_frame);
+    ExpireBursts(current_frame);
+  }
+
+  // Drops bursts once their last particle is dead. Their particles are left
+  // in place until they are most of the storage and then compacted away.
+  void ExpireBursts(int32_t current_frame) {
+    if (bursts_.empty()) return;
+    bursts_.erase(std::remove_if(bursts_.begin(), bursts_.end(),
+                                 [&](const ParticleBurst& burst) {
+                                   return current_frame >=
+                                          burst.dead_frame + MAX_DEATH_DELAY;
+                                 }),
+                  bursts_.end());
+    burst_particle_count_ = 0;
+    for (const ParticleBurst& burst : bursts_) {
+      burst_particle_count_ += burst.count;
+    }
+    if (burst_particles_.size() <=
+        2 * size_t(burst_particle_count_) + BURST_COMPACT_SLACK) {
+      return;
+    }
+    // Bursts stay in the order they were made, so everything moves down.
+    int32_t out = 0;
+    for (ParticleBurst& burst : bursts_) {
+      if (burst.first != out) {
+        std::copy_n(burst_particles_.begin() + burst.first, burst.count,
+                    burst_particles_.begin() + out);
+        burst.first = out;
       }
+      out += burst.count;
     }
+    burst_particles_.resize(out);
   }
 
   void RunMoveSystem() {
+    if (lazy_motion_) return;
     Signiture sig({.isAlive = true, .hasPosition = true, .hasVelocity = true});
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (e.Matches(sig)) {
-        CompPosition& p = position_[e.id];
-        CompVelocity v = velocity_[e.id];
-        p.x += v.dx;
-        p.y += v.dy;
-      }
-    }
+    ForEachMatch(sig, new_size_, [&](int32_t i) {
+      move(position_[ids_[i]], velocity_[ids_[i]]);
+    });
   }
 
+  // Each block records one create per explosion. Playback sorts them and
+  // makes the entities, since the rng has to be drawn from in explosion
+  // order.
   void RunExplodesSystem(int32_t current_frame) {
+    constexpr int32_t BLOCK_SIZE = 1 << 14;
     Signiture sig(
         {.hasExplodes = true, .hasGraphics = true, .hasPosition = true});
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (!e.IsAlive() && e.Matches(sig)) {
-        CompPosition pos = position_[e.id];
-        Color color = graphics_[e.id].color;
-        Entity* flash = AddEntity();
-        if (flash == nullptr) return;
-
-        int32_t life_in_frames =
-            std::uniform_int_distribution<int>(10, 30)(rng_);
-        float frame_scale = (10.0f / life_in_frames);
-        death_time_[flash->id] = {.dead_frame = current_frame + life_in_frames};
-
-        CompFades f = {
-            .a_rate = static_cast<uint8_t>(30.0f * frame_scale),
-            .a_min = 50,
-        };
-        if (color.r > color.g && color.r > color.b) {
-          f.g_min = 100;
-          f.g_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 0, .g = 255, .r = 255, .a = 255};
-        } else if (color.g > color.b) {
-          f.b_min = 100;
-          f.b_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 255, .g = 255, .r = 0, .a = 255};
-        } else {
-          f.r_min = 100;
-          f.r_rate = static_cast<uint8_t>(40.0f * frame_scale);
-          color = {.b = 255, .g = 0, .r = 255, .a = 255};
-        }
-        graphics_[flash->id] = {
+    Signiture alive({.isAlive = true});
+    const int32_t blocks = (size_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    commands_.Reset(blocks);
+    pool_->Run(blocks, [&](int32_t b) {
+      const int32_t end = std::min(size_, (b + 1) * BLOCK_SIZE);
+      ForEachMatch(sig, alive, b * BLOCK_SIZE, end, [&](int32_t i) {
+        int32_t id = ids_[i];
+        commands_[b].Create(
+            {.kind = NewEntities::Kind::EXPLOSION,
+             .explosion = {.position = PositionAt(i, current_frame - 1),
+                           .color = graphics_[id].color,
+                           .num_particles = explodes_[id].num_particles},
+             .spawn_rate = 0,
+             .explosion_particles = 0});
+      });
+    });
+    PlayBackCommands(current_frame);
+  }
+
+  // Particles start moving in current_frame.
+  void AddExplosions(int32_t current_frame) {
+    const Signiture flash_signiture({.isAlive = true,
+                                     .hasDeathTime = true,
+                                     .hasFades = true,
+                                     .hasGraphics = true,
+                                     .hasPosition = true});
+    const Signiture particle_signiture({.isAlive = true,
+                                        .hasDeathTime = true,
+                                        .hasFades = true,
+                                        .hasGraphics = true,
+                                        .hasPosition = true,
+                                        .hasVelocity = true,
+                                        .feelsGravity = true});
+    for (const Explosion& explosion : explosions_) {
+      CompPosition pos = explosion.position;
+      Color color = explosion.color;
+      int32_t flash = AddEntity();
+      if (flash < 0) return;
+      int32_t flash_id = ids_[flash];
+
+      int32_t life_in_frames = std::uniform_int_distribution<int>(10, 30)(rng_);
+      float frame_scale = (10.0f / life_in_frames);
+      death_time_[flash_id] = {.dead_frame = current_frame + life_in_frames};
+
+      CompFades f = {
+          .a_rate = static_cast<uint8_t>(30.0f * frame_scale),
+          .a_min = 50,
+      };
+      if (color.r > color.g && color.r > color.b) {
+        f.g_min = 100;
+        f.g_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 0, .g = 255, .r = 255, .a = 255};
+      } else if (color.g > color.b) {
+        f.b_min = 100;
+        f.b_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 255, .g = 255, .r = 0, .a = 255};
+      } else {
+        f.r_min = 100;
+        f.r_rate = static_cast<uint8_t>(40.0f * frame_scale);
+        color = {.b = 255, .g = 0, .r = 255, .a = 255};
+      }
+      graphics_[flash_id] = {
+          .color = color,
+          .radius = 0.03f / frame_scale,
+      };
+      SetFades(flash_id, f);
+      SetPosition(flash_id, pos);
+      motion_frame_[flash_id] = current_frame;
+      SetSigniture(flash, flash_signiture);
+
+      f.r_rate >>= 2;
+      f.g_rate >>= 2;
+      f.b_rate >>= 2;
+      f.a_rate >>= 1;
+
+      int32_t num_particles = explosion.num_particles;
+      const float vel_scale = 0.01;
+      if (particle_bursts_) {
+        AddBurst(current_frame, pos,
+                 {.color = color, .radius = 0.015f / frame_scale}, f,
+                 vel_scale,
+                 current_frame + static_cast<int>(1.5f * life_in_frames),
+                 num_particles);
+        continue;
+      }
+      const int generated_particles = std::min(num_particles, FreeSlots());
+      float chunk_size = (TWO_PI / generated_particles);
+      for (int i = 0; i < generated_particles; ++i) {
+        float min = i * chunk_size;
+        float max = (i + 1) * chunk_size;
+        float direction = std::uniform_real_distribution<float>(min, max)(rng_);
+        float unit_dx = std::cos(direction);
+        float unit_dy = std::sin(direction);
+
+        int32_t particle = AddEntity();
+        int32_t id = ids_[particle];
+        SetPosition(id, pos);
+        SetVelocity(id, {.dx = unit_dx * vel_scale, .dy = unit_dy * vel_scale});
+        motion_frame_[id] = current_frame;
+        graphics_[id] = {
             .color = color,
-            .radius = 0.03f / frame_scale,
+            .radius = 0.015f / frame_scale,
         };
+        SetFades(id, f);
+        death_time_[id] = {
+            .dead_frame = current_frame +
+                          static_cast<int>(1.5f * life_in_frames) +
+                          std::uniform_int_distribution<int>(0, 10)(rng_)};
+        SetSigniture(particle, particle_signiture);
+      }
+    }
+  }
 
-        fades_[flash->id] = f;
-
-        position_[flash->id] = pos;
-        flash->signiture = Signiture({
-            .isAlive = true,
-            .hasDeathTime = true,
-            .hasFades = true,
-            .hasGraphics = true,
-            .hasPosition = true,
-        });
-
-        int32_t num_particles = explodes_[e.id].num_particles;
-        std::vector<Entity*> particles;
-        particles.reserve(num_particles);
-        for (int i = 0; i < num_particles; ++i) {
-          Entity* particle = AddEntity();
-          if (particle == nullptr) break;
-          particles.push_back(particle);
-        }
+  // Entities that can still be added this frame.
+  int32_t FreeSlots() const {
+    return std::max(0, EntityCap() - new_size_ - burst_particle_count_);
+  }
+
+  int32_t EntityCap() const { return std::min(max_, entity_budget_); }
+
+  // Copies component, an EntityState component bit, from state.
+  void SetComponent(int32_t id, int32_t component, const EntityState& state) {
+    switch (component + Signiture::DEATH_TIME_INDEX) {
+      case Signiture::DEATH_TIME_INDEX:
+        death_time_[id] = state.death_time;
+        break;
+      case Signiture::FADES_INDEX:
+        SetFades(id, state.fades);
+        break;
+      case Signiture::EXPLODES_INDEX:
+        explodes_[id] = state.explodes;
+        break;
+      case Signiture::GRAPHICS_INDEX:
+        graphics_[id] = state.graphics;
+        break;
+      case Signiture::POSITION_INDEX:
+        SetPosition(id, state.position);
+        break;
+      case Signiture::VELOCITY_INDEX:
+        SetVelocity(id, state.velocity);
+        break;
+      default:
+        break;
+    }
+  }
 
-        f.r_rate >>= 2;
-        f.g_rate >>= 2;
-        f.b_rate >>= 2;
-        f.a_rate >>= 1;
-
-        const int generated_particles = particles.size();
-        float chunk_size = (TWO_PI / generated_particles);
-        const float vel_scale = 0.01;
-        for (int i = 0; i < generated_particles; ++i) {
-          Entity* particle = particles[i];
-          float min = i * chunk_size;
-          float max = (i + 1) * chunk_size;
-          float direction =
-              std::uniform_real_distribution<float>(min, max)(rng_);
-          float unit_dx = std::cos(direction);
-          float unit_dy = std::sin(direction);
-
-          position_[particle->id] = pos;
-          velocity_[particle->id] = {.dx = unit_dx * vel_scale,
-                                     .dy = unit_dy * vel_scale};
-          graphics_[particle->id] = {
-              .color = color,
-              .radius = 0.015f / frame_scale,
-          };
-          fades_[particle->id] = f;
-          death_time_[particle->id] = {
-              .dead_frame = current_frame +
-                            static_cast<int>(1.5f * life_in_frames) +
-                            std::uniform_int_distribution<int>(0, 10)(rng_)};
-          particle->signiture = Signiture({
-              .isAlive = true,
-              .hasDeathTime = true,
-              .hasFades = true,
-              .hasGraphics = true,
-              .hasPosition = true,
-              .hasVelocity = true,
-              .feelsGravity = true,
-          });
+  // Applies everything recorded in commands_. Entities stay at their index
+  // until the next Refresh, so commands refer to them by index. Destroyed
+  // entities are only marked dead and changes to them are dropped.
+  // Explosions are made sorted and before fireworks, so the rng is drawn
+  // from in the same order as in the acton ECS.
+  void PlayBackCommands(int32_t current_frame) {
+    explosions_.clear();
+    fireworks_.clear();
+    auto destroy = [&](int32_t i) {
+      Signiture dead = Signiture::FromBits(signitures_[i]);
+      dead.Set(Signiture::IS_ALIVE_INDEX, false);
+      SetSigniture(i, dead);
+    };
+    auto change = [&](const Commands::Command& command) {
+      if (!Signiture::FromBits(signitures_[command.entity]).IsAlive()) return;
+      switch (command.op) {
+        case Commands::Op::ADD_COMPONENT: {
+          SetComponent(ids_[command.entity], command.component, command.state);
+          Signiture sig = Signiture::FromBits(signitures_[command.entity]);
+          sig.Set(command.component + Signiture::DEATH_TIME_INDEX, true);
+          SetSigniture(command.entity, sig);
+          break;
+        }
+        case Commands::Op::REMOVE_COMPONENT: {
+          Signiture sig = Signiture::FromBits(signitures_[command.entity]);
+          sig.Set(command.component + Signiture::DEATH_TIME_INDEX, false);
+          SetSigniture(command.entity, sig);
+          break;
         }
       }
+    };
+    auto create = [&](const NewEntities& record) {
+      switch (record.kind) {
+        case NewEntities::Kind::EXPLOSION:
+          explosions_.push_back(record.explosion);
+          break;
+        case NewEntities::Kind::FIREWORKS:
+          fireworks_.push_back(record);
+          break;
+      }
+    };
+    commands_.PlayBack(destroy, change, create);
+    std::sort(explosions_.begin(), explosions_.end());
+    AddExplosions(current_frame);
+    for (const NewEntities& record : fireworks_) {
+      AddFireworks(current_frame, record.spawn_rate,
+                   record.explosion_particles);
+    }
+  }
+
+  // Adds up to num_particles burst particles, drawing from the rng in the
+  // same order as when they are entities.
+  void AddBurst(int32_t current_frame, CompPosition origin,
+                CompGraphics graphics, const CompFades& fades, float speed,
+                int32_t dead_frame, int32_t num_particles) {
+    const int32_t count = std::clamp(FreeSlots(), 0, num_particles);
+    if (count == 0) return;
+    bursts_.push_back({.origin = origin,
+                       .graphics = graphics,
+                       .fades = fades,
+                       .speed = speed,
+                       .first_frame = current_frame,
+                       .dead_frame = dead_frame,
+                       .first = static_cast<int32_t>(burst_particles_.size()),
+                       .count = count});
+    burst_particle_count_ += count;
+    auto to_unit = [](float value) {
+      return static_cast<int16_t>(
+          std::lrint(value * (1 << BURST_UNIT_BITS)));
+    };
+    float chunk_size = (TWO_PI / count);
+    for (int i = 0; i < count; ++i) {
+      float min = i * chunk_size;
+      float max = (i + 1) * chunk_size;
+      float direction = std::uniform_real_distribution<float>(min, max)(rng_);
+      int32_t delay =
+          std::uniform_int_distribution<int>(0, MAX_DEATH_DELAY)(rng_);
+      burst_particles_.push_back(
+          {.unit_dx = to_unit(std::cos(direction)),
+           .unit_dy = to_unit(std::sin(direction)),
+           .death_delay = static_cast<uint8_t>(delay)});
     }
   }
 
   void RunGravitySystem() {
+    if (lazy_motion_) return;
     Signiture sig({.isAlive = true, .hasVelocity = true, .feelsGravity = true});
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (e.Matches(sig)) {
-        CompVelocity& v = velocity_[e.id];
-        // TODO: Tune the gravity constant.
-        v.dy -= 0.0003;
-      }
+    ForEachMatch(sig, new_size_, [&](int32_t i) {
+      apply_gravity(velocity_[ids_[i]]);
+    });
+  }
+
+  // Runs after Move and Gravity, so bodies are where they end the frame and
+  // new velocities take effect from the next one.
+  void RunCollisionSystem() {
+    Signiture sig({.isAlive = true,
+                   .hasPosition = true,
+                   .hasVelocity = true,
+                   .feelsGravity = true});
+    collision_bodies_.clear();
+    collision_indices_.clear();
+    ForEachMatch(sig, new_size_, [&](int32_t i) {
+      CompPosition p = PositionAt(i, current_frame_);
+      CompVelocity v = VelocityAt(i, current_frame_);
+      collision_bodies_.push_back(
+          {.x = p.x,
+           .y = p.y,
+           .dx = v.dx,
+           .dy = v.dy,
+           .index = static_cast<int32_t>(collision_indices_.size()),
+           .hit = false});
+      collision_indices_.push_back(i);
+    });
+    collision_grid_.Build(collision_bodies_);
+    constexpr int32_t BLOCK_SIZE = 1 << 14;
+    const int32_t count = collision_bodies_.size();
+    pool_->Run((count + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](int32_t b) {
+      collide_bodies(collision_grid_, b * BLOCK_SIZE,
+                     std::min(count, (b + 1) * BLOCK_SIZE), collision_bodies_);
+    });
+    for (const CollisionBody& body : collision_bodies_) {
+      if (!body.hit) continue;
+      int32_t id = ids_[collision_indices_[body.index]];
+      SetPosition(id, {.x = body.x, .y = body.y});
+      SetVelocity(id, {.dx = body.dx, .dy = body.dy});
+      // Lazy motion starts again from here.
+      motion_frame_[id] = current_frame_ + 1;
     }
   }
 
   void RunFadeSystem() {
     Signiture sig({.isAlive = true, .hasFades = true, .hasGraphics = true});
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (e.Matches(sig)) {
-        Color& color = graphics_[e.id].color;
-        CompFades& f = fades_[e.id];
-        auto updateColor = [](uint8_t& c, uint8_t min, uint8_t rate) {
-          c = std::max(c - rate, static_cast<int32_t>(min));
-        };
-        updateColor(color.r, f.r_min, f.r_rate);
-        updateColor(color.g, f.g_min, f.g_rate);
-        updateColor(color.b, f.b_min, f.b_rate);
-        updateColor(color.a, f.a_min, f.a_rate);
-      }
-    }
+    ForEachMatch(sig, new_size_, [&](int32_t i) {
+      Color& color = graphics_[ids_[i]].color;
+      const CompFades& f = GetFades(ids_[i]);
+      auto updateColor = [](uint8_t& c, uint8_t min, uint8_t rate) {
+        c = std::max(c - rate, static_cast<int32_t>(min));
+      };
+      updateColor(color.r, f.r_min, f.r_rate);
+      updateColor(color.g, f.g_min, f.g_rate);
+      updateColor(color.b, f.b_min, f.b_rate);
+      updateColor(color.a, f.a_min, f.a_rate);
+    });
   }
 
   std::vector<ToDraw> RunGraphicsSystem() {
     Signiture sig({.isAlive = true, .hasGraphics = true, .hasPosition = true});
     std::vector<ToDraw> out;
-    out.reserve(size_);
-    for (int32_t i = 0; i < size_; ++i) {
-      Entity& e = entities_[i];
-      if (e.Matches(sig)) {
-        CompGraphics g = graphics_[e.id];
-        CompPosition p = position_[e.id];
-        out.push_back(
-            {.color = g.color, .radius = g.radius, .x = p.x, .y = p.y});
+    out.reserve(size());
+    cull_stats_ = CullStats();
+    ForEachMatch(sig, size_, [&](int32_t i) {
+      CompGraphics g = graphics_[ids_[i]];
+      CompPosition p = PositionAt(i, current_frame_);
+      ToDraw to_draw = {
+          .color = g.color, .radius = g.radius, .x = p.x, .y = p.y};
+      if (!Cull(to_draw)) out.push_back(to_draw);
+    });
+    for (const ParticleBurst& burst : bursts_) {
+      const int32_t steps = current_frame_ - burst.first_frame + 1;
+      const float scale = burst.speed * steps / (1 << BURST_UNIT_BITS);
+      const float y = burst.origin.y - GRAVITY * steps * (steps - 1) / 2;
+      ToDraw to_draw = {
+          .color = faded_color(burst.graphics.color, burst.fades, steps),
+          .radius = burst.graphics.radius,
+          .x = 0,
+          .y = 0};
+      const BurstParticle* particles = &burst_particles_[burst.first];
+      for (int32_t i = 0; i < burst.count; ++i) {
+        if (current_frame_ >= burst.dead_frame + particles[i].death_delay) {
+          continue;
+        }
+        to_draw.x = burst.origin.x + particles[i].unit_dx * scale;
+        to_draw.y = y + particles[i].unit_dy * scale;
+        if (!Cull(to_draw)) out.push_back(to_draw);
       }
     }
     return out;
   }
 
-  // TODO: evaluate if entities_ should really be some for of ordered map or
-  // have some other way to remain ordered.
-  std::vector<Entity> entities_;
-  std::vector<CompDeathTime> death_time_;
-  std::vector<CompFades> fades_;
-  std::vector<CompExplodes> explodes_;
-  std::vector<CompGraphics> graphics_;
-  std::vector<CompPosition> position_;
-  std::vector<CompVelocity> velocity_;
+#if defined(COMPACT_COMPONENTS)
+  CompPosition GetPosition(int32_t id) const { return unpack(position_[id]); }
+  void SetPosition(int32_t id, CompPosition p) { position_[id] = pack(p); }
+  CompVelocity GetVelocity(int32_t id) const { return unpack(velocity_[id]); }
+  void SetVelocity(int32_t id, CompVelocity v) { velocity_[id] = pack(v); }
+  const CompFades& GetFades(int32_t id) const {
+    return fades_table_[fades_[id]];
+  }
+  void SetFades(int32_t id, const CompFades& f) {
+    fades_[id] = fades_table_.Intern(f);
+  }
+#else
+  CompPosition GetPosition(int32_t id) const { return position_[id]; }
+  void SetPosition(int32_t id, CompPosition p) { position_[id] = p; }
+  CompVelocity GetVelocity(int32_t id) const { return velocity_[id]; }
+  void SetVelocity(int32_t id, CompVelocity v) { velocity_[id] = v; }
+  const CompFades& GetFades(int32_t id) const { return fades_[id]; }
+  void SetFades(int32_t id, const CompFades& f) { fades_[id] = f; }
+#endif
+
+  // Entity i's position and velocity once Move and Gravity have run in frame.
+  CompPosition PositionAt(int32_t i, int32_t frame) const {
+    int32_t id = ids_[i];
+    Signiture sig = Signiture::FromBits(signitures_[i]);
+    if (!lazy_motion_ || !sig[Signiture::VELOCITY_INDEX]) {
+      return GetPosition(id);
+    }
+    return ballistic_position(GetPosition(id), GetVelocity(id),
+                              sig[Signiture::FEELS_GRAVITY_INDEX],
+                              std::max(frame - motion_frame_[id] + 1, 0));
+  }
+
+  CompVelocity VelocityAt(int32_t i, int32_t frame) const {
+    int32_t id = ids_[i];
+    Signiture sig = Signiture::FromBits(signitures_[i]);
+    if (!lazy_motion_) return GetVelocity(id);
+    return ballistic_velocity(GetVelocity(id),
+                              sig[Signiture::FEELS_GRAVITY_INDEX],
+                              std::max(frame - motion_frame_[id] + 1, 0));
+  }
+
+  // Returns true if the entity should not be drawn and records why.
+  bool Cull(const ToDraw& to_draw) {
+    if (to_draw.color.a < cull_.min_alpha) {
+      ++cull_stats_.faded;
+      return true;
+    }
+    if (to_draw.radius < cull_.min_radius) {
+      ++cull_stats_.too_small;
+      return true;
+    }
+    if (IsOffscreen(cull_, to_draw)) {
+      ++cull_stats_.offscreen;
+      return true;
+    }
+    return false;
+  }
+
+  // Entity i has components at index ids_[i] and its signiture packed into
+  // signitures_[i], so systems can scan signitures without touching ids.
+  ArenaVector<int32_t> ids_;
+  ArenaVector<uint8_t> signitures_;
+  // How many entities below new_size_ have each signiture.
+  std::array<int32_t, 256> signiture_counts_;
+  // Refresh compacts into these and merges back.
+  ArenaVector<int32_t> scratch_ids_;
+  ArenaVector<uint8_t> scratch_signitures_;
+  ArenaVector<CompDeathTime> death_time_;
+#if defined(COMPACT_COMPONENTS)
+  ArenaVector<uint16_t> fades_;
+  FadesTable fades_table_;
+#else
+  ArenaVector<CompFades> fades_;
+#endif
+  ArenaVector<CompExplodes> explodes_;
+  ArenaVector<CompGraphics> graphics_;
+#if defined(COMPACT_COMPONENTS)
+  ArenaVector<PackedPosition> position_;
+  ArenaVector<PackedVelocity> velocity_;
+#else
+  ArenaVector<CompPosition> position_;
+  ArenaVector<CompVelocity> velocity_;
+#endif
+  // The first frame Move runs on each entity, for lazy motion.
+  ArenaVector<int32_t> motion_frame_;
 
   // This is the number of active entities.
   int32_t size_;
   // This is the number of active + newly created entities.
+  // Fade, Move and Gravity run up to here so entities created earlier in the
+  // frame behave the same as in ECSs that add entities immediately.
   int32_t new_size_;
   int32_t max_;
+  int32_t entity_budget_ = std::numeric_limits<int32_t>::max();
+
+  CullSettings cull_;
+  CullStats cull_stats_;
+  SystemObserver* observer_ = nullptr;
+  std::vector<Explosion> explosions_;
+  std::vector<NewEntities> fireworks_;
+  Commands commands_;
+
+  bool particle_bursts_ = false;
+  bool lazy_motion_ = false;
+  bool collisions_ = false;
+  // Reused every frame by the collision system.
+  std::vector<CollisionBody> collision_bodies_;
+  std::vector<int32_t> collision_indices_;
+  SpatialGrid<CollisionBody> collision_grid_{2 * COLLISION_RADIUS};
+  int32_t current_frame_ = 0;
+  // Bursts in the order they were made, each with a range of particles.
+  std::vector<ParticleBurst> bursts_;
+  ArenaVector<BurstParticle> burst_particles_;
+  // Particles in bursts that haven't been dropped yet, alive or not.
+  int32_t burst_particle_count_;
+
+  struct RefreshBlock {
+    int32_t begin;
+    int32_t end;
+    int32_t alive = 0;
+    // Where this block's live and dead entities go.
+    int32_t alive_out = 0;
+    int32_t dead_out = 0;
+  };
+  std::vector<RefreshBlock> refresh_blocks_;
+  std::vector<uint64_t> refresh_new_;
+  ThreadPool* pool_ = &ThreadPool::Default();
 
   pcg32 rng_;
 };
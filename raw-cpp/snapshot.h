@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Binary snapshots of a whole ECS world, so a slow frame can be reloaded
+// instead of replayed from startup.
+// A snapshot is a header, a table of named sections and then the sections.
+// Sections are raw column bytes in the host's layout and each one starts on
+// a page boundary. The file is mapped read only and loading a column is a
+// copy out of it, so the ECS's storage stays the arena's. Nothing is parsed.
+// Snapshots only load into the same ECS built the same way.
+constexpr char SNAPSHOT_MAGIC[8] = {'E', 'C', 'S', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr size_t SNAPSHOT_ALIGN = 4096;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t section_count;
+  // Which ECS wrote the snapshot, e.g. "simple-ecs".
+  char ecs[32];
+  // The last frame stepped before saving.
+  int32_t frame;
+  uint32_t reserved;
+};
+
+struct SnapshotSection {
+  char name[24];
+  uint64_t offset;
+  uint64_t bytes;
+};
+
+class SnapshotWriter {
+ public:
+  SnapshotWriter(const char* ecs, int32_t frame) {
+    std::memset(&header_, 0, sizeof(header_));
+    std::memcpy(header_.magic, SNAPSHOT_MAGIC, sizeof(header_.magic));
+    header_.version = SNAPSHOT_VERSION;
+    std::snprintf(header_.ecs, sizeof(header_.ecs), "%s", ecs);
+    header_.frame = frame;
+  }
+
+  // The data is not copied and must stay valid until Write.
+  void Add(const char* name, const void* data, size_t bytes) {
+    sections_.push_back({name, data, bytes});
+  }
+
+  template <typename Vector>
+  void AddVector(const char* name, const Vector& vector) {
+    Add(name, vector.data(), vector.size() * sizeof(vector[0]));
+  }
+
+  // Small values are copied.
+  template <typename T>
+  void AddValue(const char* name, const T& value) {
+    values_.emplace_back(reinterpret_cast<const char*>(&value), sizeof(T));
+    Add(name, nullptr, sizeof(T));
+    sections_.back().value = values_.size() - 1;
+  }
+
+  // Values with their own stream format, like pcg32.
+  template <typename T>
+  void AddStreamed(const char* name, const T& value) {
+    std::ostringstream out;
+    out << value;
+    values_.push_back(out.str());
+    Add(name, nullptr, values_.back().size());
+    sections_.back().value = values_.size() - 1;
+  }
+
+  // Written to a temporary file that replaces path, so a world still mapped
+  // from an older snapshot at path keeps its pages.
+  bool Write(const std::string& path) {
+    header_.section_count = sections_.size();
+    std::vector<SnapshotSection> table(sections_.size());
+    uint64_t offset =
+        RoundUp(sizeof(header_) + table.size() * sizeof(table[0]));
+    for (size_t i = 0; i < sections_.size(); ++i) {
+      std::memset(&table[i], 0, sizeof(table[i]));
+      std::snprintf(table[i].name, sizeof(table[i].name), "%s",
+                    sections_[i].name);
+      table[i].offset = offset;
+      table[i].bytes = sections_[i].bytes;
+      offset = RoundUp(offset + sections_[i].bytes);
+    }
+
+    std::string temp = path + ".tmp";
+    std::FILE* file = std::fopen(temp.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool ok = std::fwrite(&header_, sizeof(header_), 1, file) == 1 &&
+              (table.empty() ||
+               std::fwrite(table.data(), sizeof(table[0]), table.size(),
+                           file) == table.size());
+    for (size_t i = 0; ok && i < sections_.size(); ++i) {
+      const Section& section = sections_[i];
+      const void* data = section.value == NONE
+                             ? section.data
+                             : values_[section.value].data();
+      ok = std::fseek(file, table[i].offset, SEEK_SET) == 0 &&
+           (section.bytes == 0 ||
+            std::fwrite(data, section.bytes, 1, file) == 1);
+    }
+    // Pad the end so every section can be mapped a whole page at a time.
+    if (ok && offset > 0) {
+      ok = std::fseek(file, offset - 1, SEEK_SET) == 0 &&
+           std::fputc(0, file) != EOF;
+    }
+    ok = std::fclose(file) == 0 && ok;
+    if (ok) ok = std::rename(temp.c_str(), path.c_str()) == 0;
+    if (!ok) std::remove(temp.c_str());
+    return ok;
+  }
+
+ private:
+  static constexpr size_t NONE = static_cast<size_t>(-1);
+
+  struct Section {
+    const char* name;
+    const void* data;
+    size_t bytes;
+    size_t value = NONE;
+  };
+
+  static uint64_t RoundUp(uint64_t value) {
+    return (value + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+  }
+
+  SnapshotHeader header_;
+  std::vector<Section> sections_;
+  std::vector<std::string> values_;
+};
+
+class SnapshotReader {
+ public:
+  SnapshotReader() = default;
+  SnapshotReader(const SnapshotReader&) = delete;
+  SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+  ~SnapshotReader() {
+#if defined(__linux__)
+    if (data_ != nullptr) munmap(const_cast<uint8_t*>(data_), size_);
+    if (fd_ >= 0) close(fd_);
+#endif
+  }
+
+  // Returns false if path isn't a snapshot this build can read.
+  bool Open(const std::string& path) {
+#if defined(__linux__)
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || size_t(st.st_size) < sizeof(SnapshotHeader)) {
+      return false;
+    }
+    size_ = st.st_size;
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data == MAP_FAILED) return false;
+    data_ = static_cast<const uint8_t*>(data);
+#else
+    (void)path;
+    return false;
+#endif
+    std::memcpy(&header_, data_, sizeof(header_));
+    if (std::memcmp(header_.magic, SNAPSHOT_MAGIC, sizeof(header_.magic)) !=
+            0 ||
+        header_.version != SNAPSHOT_VERSION) {
+      return false;
+    }
+    const size_t table_end =
+        sizeof(header_) + header_.section_count * sizeof(SnapshotSection);
+    if (table_end > size_) return false;
+    table_.resize(header_.section_count);
+    std::memcpy(table_.data(), data_ + sizeof(header_),
+                table_.size() * sizeof(table_[0]));
+    for (const SnapshotSection& section : table_) {
+      if (section.offset % SNAPSHOT_ALIGN != 0 || section.offset > size_ ||
+          section.bytes > size_ - section.offset) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string ecs() const {
+    return std::string(header_.ecs, strnlen(header_.ecs, sizeof(header_.ecs)));
+  }
+  int32_t frame() const { return header_.frame; }
+
+  // Returns the section's bytes, or nullptr if there is no such section.
+  const uint8_t* Find(const char* name, size_t& bytes) const {
+    for (const SnapshotSection& section : table_) {
+      if (std::strncmp(section.name, name, sizeof(section.name)) == 0) {
+        bytes = section.bytes;
+        return data_ + section.offset;
+      }
+    }
+    return nullptr;
+  }
+
+  // Fills dest with the section, which must be exactly bytes long.
+  bool Read(const char* name, void* dest, size_t bytes) const {
+    size_t found_bytes;
+    const uint8_t* found = Find(name, found_bytes);
+    if (found == nullptr || found_bytes != bytes) return false;
+    if (bytes != 0) std::memcpy(dest, found, bytes);
+    return true;
+  }
+
+  // Reads a column into vector, which must already have its size.
+  template <typename Vector>
+  bool ReadVector(const char* name, Vector& vector) const {
+    return Read(name, vector.data(), vector.size() * sizeof(vector[0]));
+  }
+
+  // Resizes vector to fit the section and reads it.
+  template <typename Vector>
+  bool ReadResized(const char* name, Vector& vector) const {
+    size_t bytes;
+    if (Find(name, bytes) == nullptr || bytes % sizeof(vector[0]) != 0) {
+      return false;
+    }
+    vector.resize(bytes / sizeof(vector[0]));
+    return ReadVector(name, vector);
+  }
+
+  template <typename T>
+  bool ReadValue(const char* name, T& value) const {
+    return Read(name, &value, sizeof(T));
+  }
+
+  template <typename T>
+  bool ReadStreamed(const char* name, T& value) const {
+    size_t bytes;
+    const uint8_t* found = Find(name, bytes);
+    if (found == nullptr) return false;
+    std::istringstream in(
+        std::string(reinterpret_cast<const char*>(found), bytes));
+    return static_cast<bool>(in >> value);
+  }
+
+ private:
+  int fd_ = -1;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  SnapshotHeader header_;
+  std::vector<SnapshotSection> table_;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A set of entity ids with O(1) insert, erase and membership, for
+// components that would otherwise split architypes for little data, like
+// tags. Members are kept packed so they can be listed, and a bitmap with a
+// bit per id answers membership for queries walking architype chunks.
+// Storage grows to the largest id inserted.
+class SparseSet {
+ public:
+  bool Contains(int32_t id) const {
+    const size_t word = id >> 6;
+    return word < bits_.size() && (bits_[word] >> (id & 63) & 1);
+  }
+
+  void Insert(int32_t id) {
+    if (Contains(id)) return;
+    if (static_cast<size_t>(id) >= index_.size()) {
+      index_.resize(std::max<size_t>(id + 1, 2 * index_.size()));
+      bits_.resize((index_.size() + 63) / 64);
+    }
+    index_[id] = dense_.size();
+    dense_.push_back(id);
+    bits_[id >> 6] |= uint64_t{1} << (id & 63);
+  }
+
+  // Moves the last member into the erased one's place.
+  void Erase(int32_t id) {
+    if (!Contains(id)) return;
+    const int32_t last = dense_.back();
+    dense_[index_[id]] = last;
+    index_[last] = index_[id];
+    dense_.pop_back();
+    bits_[id >> 6] &= ~(uint64_t{1} << (id & 63));
+  }
+
+  void Clear() {
+    dense_.clear();
+    index_.clear();
+    bits_.clear();
+  }
+
+  int32_t size() const { return dense_.size(); }
+  const std::vector<int32_t>& members() const { return dense_; }
+
+  size_t reserved_bytes() const {
+    return dense_.capacity() * sizeof(int32_t) +
+           index_.capacity() * sizeof(int32_t) +
+           bits_.capacity() * sizeof(uint64_t);
+  }
+
+ private:
+  std::vector<int32_t> dense_;
+  // Where each member is in dense_. Only valid for members.
+  std::vector<int32_t> index_;
+  std::vector<uint64_t> bits_;
+};
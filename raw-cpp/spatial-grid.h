@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// A uniform grid over the unit square that positions map to on screen, for
+// finding things near each other without comparing every pair.
+// Build sorts items by row and then column with two counting sorts, which
+// only need a counter per row and per column, and then records the range of
+// items in each occupied cell. Rebuilding only clears the cells that were
+// occupied before, so a fine grid costs nothing for cells nobody is in.
+// Items off the screen go in the nearest edge cell. T needs float x and y.
+template <typename T>
+class SpatialGrid {
+ public:
+  // Cells are at least cell_size on each side.
+  explicit SpatialGrid(float cell_size)
+      : cells_per_side_(std::max(1, static_cast<int32_t>(1.0f / cell_size))) {}
+
+  void Build(const std::vector<T>& items) {
+    if (cells_.empty()) cells_.resize(cells_per_side_ * cells_per_side_);
+    for (int32_t cell : occupied_) cells_[cell] = CellRange();
+    occupied_.clear();
+
+    const int32_t count = items.size();
+    column_of_.resize(count);
+    row_of_.resize(count);
+    column_start_.assign(cells_per_side_ + 1, 0);
+    row_start_.assign(cells_per_side_ + 1, 0);
+    for (int32_t i = 0; i < count; ++i) {
+      column_of_[i] = Cell(items[i].x);
+      row_of_[i] = Cell(items[i].y);
+      ++column_start_[column_of_[i] + 1];
+      ++row_start_[row_of_[i] + 1];
+    }
+    for (int32_t c = 0; c < cells_per_side_; ++c) {
+      column_start_[c + 1] += column_start_[c];
+      row_start_[c + 1] += row_start_[c];
+    }
+    // Sorted by column first, so the stable sort by row keeps each row in
+    // column order.
+    by_column_.resize(count);
+    for (int32_t i = 0; i < count; ++i) {
+      by_column_[column_start_[column_of_[i]]++] = i;
+    }
+    sorted_.resize(count);
+    for (int32_t i : by_column_) {
+      const int32_t out = row_start_[row_of_[i]]++;
+      sorted_[out] = items[i];
+    }
+    // Runs of the same cell are now contiguous.
+    int32_t previous = -1;
+    for (int32_t j = 0; j < count; ++j) {
+      const int32_t cell = CellOf(sorted_[j]);
+      if (cell != previous) {
+        cells_[cell].begin = j;
+        occupied_.push_back(cell);
+        previous = cell;
+      }
+      cells_[cell].end = j + 1;
+    }
+  }
+
+  // Every item from the last Build, sorted by row and then column.
+  const std::vector<T>& items() const { return sorted_; }
+
+  // Calls f(j) for every j in items() whose cell overlaps the square of
+  // half width radius around (x, y). Callers check the actual distance.
+  template <typename F>
+  void ForEachNear(float x, float y, float radius, F f) const {
+    const int32_t x0 = Cell(x - radius);
+    const int32_t x1 = Cell(x + radius);
+    const int32_t y1 = Cell(y + radius);
+    for (int32_t cy = Cell(y - radius); cy <= y1; ++cy) {
+      const CellRange* row = &cells_[cy * cells_per_side_];
+      for (int32_t cx = x0; cx <= x1; ++cx) {
+        for (int32_t j = row[cx].begin; j < row[cx].end; ++j) f(j);
+      }
+    }
+  }
+
+ private:
+  struct CellRange {
+    int32_t begin = 0;
+    int32_t end = 0;
+  };
+
+  int32_t Cell(float v) const {
+    return static_cast<int32_t>(
+        std::clamp(v * cells_per_side_, 0.0f, cells_per_side_ - 1.0f));
+  }
+
+  int32_t CellOf(const T& item) const {
+    return Cell(item.y) * cells_per_side_ + Cell(item.x);
+  }
+
+  int32_t cells_per_side_;
+  // Allocated on the first Build so unused grids stay small.
+  std::vector<CellRange> cells_;
+  std::vector<int32_t> occupied_;
+  // Scratch for Build.
+  std::vector<int32_t> column_start_;
+  std::vector<int32_t> row_start_;
+  std::vector<int32_t> column_of_;
+  std::vector<int32_t> row_of_;
+  std::vector<int32_t> by_column_;
+  std::vector<T> sorted_;
+};
+
+// A particle as the collision system sees it. index is its position in the
+// vector the grid was built from.
+struct CollisionBody {
+  float x;
+  float y;
+  float dx;
+  float dy;
+  int32_t index;
+  bool hit;
+};
+
+// Every body is a disc of this radius, whatever size it is drawn.
+constexpr float COLLISION_RADIUS = 0.001f;
+// The fraction of speed kept bouncing off the bottom of the screen.
+constexpr float GROUND_RESTITUTION = 0.6f;
+
+// Bounces bodies [begin, end) of grid.items() off the ground and off each
+// other, writing them to out at their index with hit set if they changed,
+// so callers can write them back in the order they were gathered. Every
+// body reacts to its neighbors as they were before this frame's collisions,
+// so blocks can run in any order and the result doesn't depend on it.
+// Equal mass discs that are closing swap their velocities along the line
+// between them, which is an elastic bounce.
+inline void collide_bodies(const SpatialGrid<CollisionBody>& grid,
+                           int32_t begin, int32_t end,
+                           std::vector<CollisionBody>& out) {
+  constexpr float DIAMETER = 2 * COLLISION_RADIUS;
+  const std::vector<CollisionBody>& bodies = grid.items();
+  for (int32_t i = begin; i < end; ++i) {
+    CollisionBody body = bodies[i];
+    body.hit = false;
+    grid.ForEachNear(body.x, body.y, DIAMETER, [&](int32_t j) {
+      const CollisionBody& other = bodies[j];
+      const float nx = other.x - body.x;
+      const float ny = other.y - body.y;
+      const float distance_sq = nx * nx + ny * ny;
+      const float closing =
+          (other.dx - bodies[i].dx) * nx + (other.dy - bodies[i].dy) * ny;
+      // Most neighbors aren't touching, so this avoids branching on it.
+      // Itself and anything exactly on top of it are at distance 0.
+      const bool touching = (distance_sq < DIAMETER * DIAMETER) &
+                            (distance_sq > 0) & (closing < 0);
+      const float impulse = touching * closing /
+                            std::max(distance_sq, DIAMETER * DIAMETER * 1e-6f);
+      body.dx += impulse * nx;
+      body.dy += impulse * ny;
+      body.hit |= touching;
+    });
+    if (body.y < 0 && body.dy < 0) {
+      body.y = -body.y;
+      body.dy *= -GROUND_RESTITUTION;
+      body.hit = true;
+    }
+    out[body.index] = body;
+  }
+}
@@ -0,0 +1,598 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+
+#if defined(SIMPLE_ECS)
+#include "simple-ecs.h"
+#elif defined(ACTON_ECS)
+#include "acton-inspired-ecs.h"
+#endif
+#include "shards.h"
+
+// Component sizes as stored, which is what the systems stream through.
+#if defined(COMPACT_COMPONENTS)
+using StoredPosition = PackedPosition;
+using StoredVelocity = PackedVelocity;
+using StoredFades = uint16_t;
+#else
+using StoredPosition = CompPosition;
+using StoredVelocity = CompVelocity;
+using StoredFades = CompFades;
+#endif
+
+// Benchmarks every system on its own over worlds of 1k to 4M entities with
+// controlled archetype mixes. Like main.cc, this is built once per ECS.
+// Bytes per second count the component bytes a system reads and writes for
+// each entity it processes.
+
+enum Mix : int64_t {
+  kParticles = 0,
+  // One explosion's worth of entities: a firework, a flash and 16 particles.
+  kExplosions = 1,
+  kFireworks = 2,
+};
+
+enum class Kind { kFirework, kFlash, kParticle };
+
+constexpr int32_t NEVER = std::numeric_limits<int32_t>::max();
+
+Kind KindFor(Mix mix, int64_t i) {
+  switch (mix) {
+    case kParticles:
+      return Kind::kParticle;
+    case kFireworks:
+      return Kind::kFirework;
+    default:
+      switch (i % 18) {
+        case 0:
+          return Kind::kFirework;
+        case 1:
+          return Kind::kFlash;
+        default:
+          return Kind::kParticle;
+      }
+  }
+}
+
+struct Components {
+  CompDeathTime death_time;
+  CompFades fades;
+  CompExplodes explodes;
+  CompGraphics graphics;
+  CompPosition position;
+  CompVelocity velocity;
+};
+
+Components MakeComponents(Kind kind, int32_t dead_frame, pcg32& rng) {
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::uniform_real_distribution<float> speed(-0.01f, 0.01f);
+  Components c = {};
+  c.death_time = {.dead_frame = dead_frame};
+  c.fades = {.r_rate = 2,
+             .r_min = 100,
+             .g_rate = 0,
+             .g_min = 0,
+             .b_rate = 0,
+             .b_min = 0,
+             .a_rate = 7,
+             .a_min = 50};
+  c.explodes = {.num_particles = 16};
+  c.graphics = {.color = {.b = 255, .g = 0, .r = 255, .a = 255},
+                .radius = kind == Kind::kFirework ? 0.02f : 0.015f};
+  c.position = {.x = unit(rng), .y = unit(rng)};
+  c.velocity = {.dx = speed(rng), .dy = speed(rng)};
+  return c;
+}
+
+// Reaches into the ECS to build worlds and run single systems.
+class SystemBench {
+ public:
+  // FeelsGravity's bit in EntityState::components.
+  static constexpr int32_t GRAVITY_COMPONENT =
+      Signiture::FEELS_GRAVITY_INDEX - Signiture::DEATH_TIME_INDEX;
+
+  static void Add(ECS& ecs, Kind kind, int32_t dead_frame, pcg32& rng) {
+    Components c = MakeComponents(kind, dead_frame, rng);
+#if defined(SIMPLE_ECS)
+    int32_t index = ecs.AddEntity();
+    if (index < 0) return;
+    int32_t id = ecs.ids_[index];
+    ecs.death_time_[id] = c.death_time;
+    ecs.graphics_[id] = c.graphics;
+    ecs.SetPosition(id, c.position);
+    switch (kind) {
+      case Kind::kFirework:
+        ecs.explodes_[id] = c.explodes;
+        ecs.SetVelocity(id, c.velocity);
+        ecs.SetSigniture(index, Signiture({.isAlive = true,
+                                           .hasDeathTime = true,
+                                           .hasExplodes = true,
+                                           .hasGraphics = true,
+                                           .hasPosition = true,
+                                           .hasVelocity = true}));
+        break;
+      case Kind::kFlash:
+        ecs.SetFades(id, c.fades);
+        ecs.SetSigniture(index, Signiture({.isAlive = true,
+                                           .hasDeathTime = true,
+                                           .hasFades = true,
+                                           .hasGraphics = true,
+                                           .hasPosition = true}));
+        break;
+      case Kind::kParticle:
+        ecs.SetFades(id, c.fades);
+        ecs.SetVelocity(id, c.velocity);
+        ecs.SetSigniture(index, Signiture({.isAlive = true,
+                                           .hasDeathTime = true,
+                                           .hasFades = true,
+                                           .hasGraphics = true,
+                                           .hasPosition = true,
+                                           .hasVelocity = true,
+                                           .feelsGravity = true}));
+        break;
+    }
+#elif defined(ACTON_ECS)
+    switch (kind) {
+      case Kind::kFirework:
+        ecs.AddEntity(Signiture({.hasDeathTime = true,
+                                 .hasExplodes = true,
+                                 .hasGraphics = true,
+                                 .hasPosition = true,
+                                 .hasVelocity = true}),
+                      c.death_time, std::nullopt, c.explodes, c.graphics,
+                      c.position, c.velocity);
+        break;
+      case Kind::kFlash:
+        ecs.AddEntity(Signiture({.hasDeathTime = true,
+                                 .hasFades = true,
+                                 .hasGraphics = true,
+                                 .hasPosition = true}),
+                      c.death_time, c.fades, std::nullopt, c.graphics,
+                      c.position, std::nullopt);
+        break;
+      case Kind::kParticle:
+        ecs.AddEntity(Signiture({.hasDeathTime = true,
+                                 .hasFades = true,
+                                 .hasGraphics = true,
+                                 .hasPosition = true,
+                                 .hasVelocity = true,
+                                 .feelsGravity = true}),
+                      c.death_time, c.fades, std::nullopt, c.graphics,
+                      c.position, c.velocity);
+        break;
+    }
+#endif
+  }
+
+  // Makes everything added so far part of the active entities.
+  static void Activate(ECS& ecs) {
+#if defined(SIMPLE_ECS)
+    ecs.Refresh();
+#else
+    (void)ecs;
+#endif
+  }
+
+  static std::unique_ptr<ECS> MakeWorld(int64_t count, Mix mix,
+                                        int64_t capacity,
+                                        int32_t dead_frame = NEVER) {
+    auto ecs = std::make_unique<ECS>(capacity, /*seed=*/42);
+    pcg32 rng(7);
+    for (int64_t i = 0; i < count; ++i) {
+      Add(*ecs, KindFor(mix, i), dead_frame, rng);
+    }
+    Activate(*ecs);
+    return ecs;
+  }
+
+  static void Death(ECS& ecs, int32_t frame) { ecs.RunDeathSystem(frame); }
+  static void Explodes(ECS& ecs, int32_t frame) {
+    ecs.RunExplodesSystem(frame);
+  }
+  static void Fade(ECS& ecs) { ecs.RunFadeSystem(); }
+  static void Move(ECS& ecs) { ecs.RunMoveSystem(); }
+  static void Gravity(ECS& ecs) { ecs.RunGravitySystem(); }
+  static void Collision(ECS& ecs) { ecs.RunCollisionSystem(); }
+  static std::vector<ToDraw> Graphics(ECS& ecs) {
+    return ecs.RunGraphicsSystem();
+  }
+#if defined(SIMPLE_ECS)
+  static void Refresh(ECS& ecs) { ecs.Refresh(); }
+
+  // The unordered two pointer swap loop Refresh used before it kept entities
+  // sorted, kept to compare against.
+  static void SwapRefresh(ECS& ecs) {
+    auto is_alive = [&](int32_t i) {
+      return Signiture::FromBits(ecs.signitures_[i]).IsAlive();
+    };
+    int32_t i = 0;
+    int32_t j = ecs.new_size_ - 1;
+    while (i <= j) {
+      while (i < ecs.max_ && is_alive(i)) ++i;
+      if (i == ecs.max_ || i >= j) break;
+      while (!is_alive(j)) --j;
+      if (i >= j) break;
+      std::swap(ecs.ids_[i], ecs.ids_[j]);
+      std::swap(ecs.signitures_[i], ecs.signitures_[j]);
+    }
+    ecs.size_ = i;
+    ecs.new_size_ = i;
+    ecs.ClearDeadSignitureCounts();
+  }
+
+  // Kills and replaces `churn` random active entities without refreshing.
+  static void Churn(ECS& ecs, int64_t churn, pcg32& rng) {
+    std::uniform_int_distribution<int32_t> index(0, ecs.size_ - 1);
+    for (int64_t i = 0; i < churn; ++i) {
+      int32_t victim = index(rng);
+      Signiture sig = Signiture::FromBits(ecs.signitures_[victim]);
+      sig.Set(Signiture::IS_ALIVE_INDEX, false);
+      ecs.SetSigniture(victim, sig);
+    }
+    for (int64_t i = 0; i < churn; ++i) {
+      Add(ecs, Kind::kParticle, NEVER, rng);
+    }
+  }
+
+  // Takes gravity away from every particle, or gives it back, with the
+  // commands a system would record.
+  static void SetGravity(ECS& ecs, bool feels) {
+    const Signiture particle(
+        {.isAlive = true, .hasFades = true, .hasVelocity = true});
+    ecs.commands_.Reset(1);
+    for (int32_t i = 0; i < ecs.new_size_; ++i) {
+      if (!Signiture::FromBits(ecs.signitures_[i]).Matches(particle)) continue;
+      if (feels) {
+        ecs.commands_[0].AddComponent(i, GRAVITY_COMPONENT, {});
+      } else {
+        ecs.commands_[0].RemoveComponent(i, GRAVITY_COMPONENT);
+      }
+    }
+    ecs.PlayBackCommands(/*current_frame=*/0);
+  }
+#elif defined(ACTON_ECS)
+  // Takes gravity away from every particle, or gives it back, with the
+  // commands a system would record.
+  static void SetGravity(ECS& ecs, bool feels) {
+    const Signiture particle({.hasFades = true, .hasVelocity = true});
+    ecs.commands_.Reset(1);
+    for (size_t a = 0; a < ecs.architypes_.size(); ++a) {
+      const Architype& architype = ecs.architypes_[a];
+      if (!architype.Matches(particle)) continue;
+      for (size_t c = 0; c < architype.chunks.size(); ++c) {
+        for (int32_t i = 0; i < architype.chunks[c].size; ++i) {
+          EntitySlot slot = {.architype = static_cast<int32_t>(a),
+                             .chunk = static_cast<int32_t>(c),
+                             .index = i};
+          if (feels) {
+            ecs.commands_[0].AddComponent(slot, GRAVITY_COMPONENT, {});
+          } else {
+            ecs.commands_[0].RemoveComponent(slot, GRAVITY_COMPONENT);
+          }
+        }
+      }
+    }
+    ecs.PlayBackCommands(/*current_frame=*/0);
+  }
+#endif
+
+  // Live entities that have every component in signiture.
+  static int64_t CountMatching(const ECS& ecs, Signiture signiture) {
+    const uint32_t components =
+        signiture.bits() >> Signiture::DEATH_TIME_INDEX;
+    int64_t count = 0;
+    ecs.ForEachLiveEntity([&](const EntityState& entity) {
+      count += (entity.components & components) == components;
+    });
+    return count;
+  }
+};
+
+// items is how many entities the system matched. A system that matched
+// none has no rate, rather than one counting entities it never touched.
+void ReportThroughput(benchmark::State& state, int64_t items,
+                      int64_t bytes_per_item) {
+  if (items == 0) return;
+  state.SetItemsProcessed(state.iterations() * items);
+  state.SetBytesProcessed(state.iterations() * items * bytes_per_item);
+}
+
+void WorldSizes(benchmark::internal::Benchmark* b) {
+  for (int64_t mix : {kParticles, kExplosions, kFireworks}) {
+    for (int64_t count = 1 << 10; count <= 1 << 22; count <<= 3) {
+      b->Args({count, mix});
+    }
+  }
+  b->ArgNames({"entities", "mix"})->Unit(benchmark::kMicrosecond);
+}
+
+void BM_Death(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), Mix(state.range(1)),
+                                    state.range(0));
+  const int64_t matched = SystemBench::CountMatching(
+      *ecs, Signiture({.hasDeathTime = true}));
+  for (auto _ : state) {
+    SystemBench::Death(*ecs, 0);
+  }
+  ReportThroughput(state, matched, sizeof(CompDeathTime));
+}
+BENCHMARK(BM_Death)->Apply(WorldSizes);
+
+void BM_Fade(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), Mix(state.range(1)),
+                                    state.range(0));
+  const int64_t matched = SystemBench::CountMatching(
+      *ecs, Signiture({.hasFades = true, .hasGraphics = true}));
+  for (auto _ : state) {
+    SystemBench::Fade(*ecs);
+  }
+  ReportThroughput(state, matched,
+                   sizeof(StoredFades) + 2 * sizeof(Color));
+}
+BENCHMARK(BM_Fade)->Apply(WorldSizes);
+
+void BM_Move(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), Mix(state.range(1)),
+                                    state.range(0));
+  const int64_t matched = SystemBench::CountMatching(
+      *ecs, Signiture({.hasPosition = true, .hasVelocity = true}));
+  for (auto _ : state) {
+    SystemBench::Move(*ecs);
+  }
+  ReportThroughput(state, matched,
+                   2 * sizeof(StoredPosition) + sizeof(StoredVelocity));
+}
+BENCHMARK(BM_Move)->Apply(WorldSizes);
+
+void BM_Gravity(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), Mix(state.range(1)),
+                                    state.range(0));
+  const int64_t matched = SystemBench::CountMatching(
+      *ecs, Signiture({.hasVelocity = true, .feelsGravity = true}));
+  for (auto _ : state) {
+    SystemBench::Gravity(*ecs);
+  }
+  ReportThroughput(state, matched, 2 * sizeof(StoredVelocity));
+}
+BENCHMARK(BM_Gravity)->Apply(WorldSizes);
+
+// Particles spread evenly over the screen. They get more crowded as the world
+// grows, so the time per entity grows with the neighbors each one has to
+// check rather than with the size of the world.
+void BM_Collision(benchmark::State& state) {
+  auto ecs =
+      SystemBench::MakeWorld(state.range(0), kParticles, state.range(0));
+  for (auto _ : state) {
+    SystemBench::Collision(*ecs);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Collision)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 20)
+    ->ArgName("entities")
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_Graphics(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), Mix(state.range(1)),
+                                    state.range(0));
+  const int64_t matched = SystemBench::CountMatching(
+      *ecs, Signiture({.hasGraphics = true, .hasPosition = true}));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(SystemBench::Graphics(*ecs));
+  }
+  ReportThroughput(state, matched,
+                   sizeof(CompGraphics) + sizeof(StoredPosition) +
+                       sizeof(ToDraw));
+}
+BENCHMARK(BM_Graphics)->Apply(WorldSizes);
+
+// Every firework dies at once and explodes into 16 particles and a flash.
+// The range is the number of entities created.
+void BM_Explodes(benchmark::State& state) {
+  const int64_t fireworks = state.range(0) / 17;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto ecs = SystemBench::MakeWorld(fireworks, kFireworks, fireworks * 18,
+                                      /*dead_frame=*/0);
+    SystemBench::Death(*ecs, 0);
+    state.ResumeTiming();
+    SystemBench::Explodes(*ecs, 0);
+  }
+  ReportThroughput(state, fireworks * 17,
+                   sizeof(CompDeathTime) + sizeof(CompFades) +
+                       sizeof(CompGraphics) + sizeof(CompPosition) +
+                       sizeof(CompVelocity));
+}
+BENCHMARK(BM_Explodes)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 20)
+    ->ArgName("entities")
+    ->Unit(benchmark::kMicrosecond);
+
+// Creating an ECS allocates its component storage. After the first
+// iteration the blocks come back out of the PageArena's free lists.
+void BM_Startup(benchmark::State& state) {
+  for (auto _ : state) {
+    ECS ecs(state.range(0), /*seed=*/42);
+    benchmark::DoNotOptimize(ecs);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Startup)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 22)
+    ->ArgName("entities")
+    ->Unit(benchmark::kMicrosecond);
+
+// Every particle loses gravity and then gets it back through recorded
+// component changes. In the acton ECS gravity is kept in a sparse set, so
+// this only flips bits and never moves an entity between architypes. The
+// playback is checked once before it is timed.
+void BM_ToggleGravity(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), kParticles,
+                                    state.range(0));
+  SystemBench::SetGravity(*ecs, false);
+  const Signiture gravity({.feelsGravity = true});
+  const int64_t without = SystemBench::CountMatching(*ecs, gravity);
+  SystemBench::SetGravity(*ecs, true);
+  if (without != 0 ||
+      SystemBench::CountMatching(*ecs, gravity) != state.range(0)) {
+    state.SkipWithError("gravity was not toggled on every particle");
+    return;
+  }
+  for (auto _ : state) {
+    SystemBench::SetGravity(*ecs, false);
+    SystemBench::SetGravity(*ecs, true);
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * state.range(0));
+}
+BENCHMARK(BM_ToggleGravity)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 20)
+    ->ArgName("entities")
+    ->Unit(benchmark::kMicrosecond);
+
+#if defined(SIMPLE_ECS)
+// Replaces 2% of the entities every frame, then compacts, either with
+// Refresh or with the old swap loop.
+void BM_Refresh(benchmark::State& state) {
+  const int64_t count = state.range(0);
+  const bool swap = state.range(1);
+  const int64_t churn = std::max<int64_t>(count / 50, 1);
+  auto ecs = SystemBench::MakeWorld(count, kParticles, count + churn);
+  pcg32 rng(3);
+  for (auto _ : state) {
+    state.PauseTiming();
+    SystemBench::Churn(*ecs, churn, rng);
+    state.ResumeTiming();
+    if (swap) {
+      SystemBench::SwapRefresh(*ecs);
+    } else {
+      SystemBench::Refresh(*ecs);
+    }
+  }
+  ReportThroughput(state, count + churn,
+                   sizeof(int32_t) + sizeof(uint8_t));
+}
+BENCHMARK(BM_Refresh)
+    ->ArgsProduct({{1 << 10, 1 << 16, 1 << 20, 1 << 22}, {0, 1}})
+    ->ArgNames({"entities", "swap"})
+    ->Unit(benchmark::kMicrosecond);
+
+// Move over a world that has been through 100 frames of 2% churn, to see how
+// the order Refresh leaves entities in affects the systems after it.
+void BM_MoveAfterChurn(benchmark::State& state) {
+  const int64_t count = state.range(0);
+  const bool swap = state.range(1);
+  const int64_t churn = std::max<int64_t>(count / 50, 1);
+  auto ecs = SystemBench::MakeWorld(count, kParticles, count + churn);
+  pcg32 rng(3);
+  for (int frame = 0; frame < 100; ++frame) {
+    SystemBench::Churn(*ecs, churn, rng);
+    if (swap) {
+      SystemBench::SwapRefresh(*ecs);
+    } else {
+      SystemBench::Refresh(*ecs);
+    }
+  }
+  for (auto _ : state) {
+    SystemBench::Move(*ecs);
+  }
+  ReportThroughput(state, count,
+                   2 * sizeof(CompPosition) + sizeof(CompVelocity));
+}
+BENCHMARK(BM_MoveAfterChurn)
+    ->ArgsProduct({{1 << 20, 1 << 22}, {0, 1}})
+    ->ArgNames({"entities", "swap"})
+    ->Unit(benchmark::kMicrosecond);
+
+// BM_Explodes with the particles stored as bursts, and then a frame of
+// drawing them. Burst particles are only written once per explosion but are
+// evaluated from scratch by Graphics.
+void BM_ExplodesBursts(benchmark::State& state) {
+  const int64_t fireworks = state.range(0) / 17;
+  const bool bursts = state.range(1);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto ecs = SystemBench::MakeWorld(fireworks, kFireworks, fireworks * 18,
+                                      /*dead_frame=*/0);
+    ecs->SetParticleBursts(bursts);
+    SystemBench::Death(*ecs, 0);
+    state.ResumeTiming();
+    SystemBench::Explodes(*ecs, 0);
+    SystemBench::Refresh(*ecs);
+    benchmark::DoNotOptimize(SystemBench::Graphics(*ecs));
+  }
+  state.SetItemsProcessed(state.iterations() * fireworks * 17);
+}
+BENCHMARK(BM_ExplodesBursts)
+    ->ArgsProduct({{1 << 14, 1 << 20}, {0, 1}})
+    ->ArgNames({"entities", "bursts"})
+    ->Unit(benchmark::kMicrosecond);
+
+// A whole frame that isn't drawn, with Move and Gravity run every frame or
+// left to lazy motion.
+void BM_UndrawnFrame(benchmark::State& state) {
+  auto ecs = SystemBench::MakeWorld(state.range(0), kParticles,
+                                    state.range(0));
+  ecs->SetLazyMotion(state.range(1));
+  int32_t frame = 0;
+  for (auto _ : state) {
+    ecs->Step(frame++, /*spawn_rate=*/0.0f, /*explosion_particles=*/16,
+              /*draw=*/false);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UndrawnFrame)
+    ->ArgsProduct({{1 << 16, 1 << 20, 1 << 22}, {0, 1}})
+    ->ArgNames({"entities", "lazy"})
+    ->Unit(benchmark::kMicrosecond);
+#endif
+
+// Whole drawn frames of a full world split into 1 shard up to one per core,
+// for scaling curves. The total entity cap stays the same, so perfect
+// scaling halves the time every time the shards double.
+void BM_ShardedFrame(benchmark::State& state) {
+  const int32_t entities = state.range(0);
+  ShardedWorlds<ECS> worlds(state.range(1), entities, /*seed=*/42);
+  const float spawn_rate = entities / 100.0f;
+  int32_t frame = 0;
+  // Long enough for the first fireworks to explode and the world to fill.
+  for (; frame < 200; ++frame) {
+    worlds.Step(frame, spawn_rate, /*explosion_particles=*/16);
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        worlds.Step(frame++, spawn_rate, /*explosion_particles=*/16));
+  }
+  state.SetItemsProcessed(state.iterations() * worlds.size());
+}
+
+void ShardCounts(benchmark::internal::Benchmark* b) {
+  const int64_t cores = std::max(1u, std::thread::hardware_concurrency());
+  for (int64_t entities : {1 << 18, 1 << 20}) {
+    for (int64_t shards = 1; shards < cores; shards *= 2) {
+      b->Args({entities, shards});
+    }
+    b->Args({entities, cores});
+  }
+  b->ArgNames({"entities", "shards"})
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+}
+BENCHMARK(BM_ShardedFrame)->Apply(ShardCounts);
+
+// Run with ECS_FORCE_ISA set to compare the kernel variants on one host.
+int main(int argc, char** argv) {
+  benchmark::AddCustomContext("kernels", isa_name(kernel_isa()));
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for splitting loops into blocks.
+// Run blocks until every block is done and the calling thread works on blocks
+// too. A Run from inside a block just runs serially on that thread, so nested
+// parallel loops can't deadlock.
+class ThreadPool {
+ public:
+  // threads includes the thread that calls Run.
+  explicit ThreadPool(int32_t threads) {
+    for (int32_t i = 1; i < threads; ++i) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) worker.join();
+  }
+
+  // One thread per core, shared by everything in the process.
+  static ThreadPool& Default() {
+    static ThreadPool pool(
+        std::max<int32_t>(std::thread::hardware_concurrency(), 1));
+    return pool;
+  }
+
+  int32_t size() const { return workers_.size() + 1; }
+
+  // Calls f(block) once for every block in [0, blocks), in no particular
+  // order.
+  void Run(int32_t blocks, const std::function<void(int32_t)>& f) {
+    if (blocks <= 1 || workers_.empty() || in_block_) {
+      for (int32_t block = 0; block < blocks; ++block) f(block);
+      return;
+    }
+    // Only one loop can use the workers at a time.
+    std::lock_guard<std::mutex> running(run_mutex_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &f;
+      blocks_ = blocks;
+      next_.store(0, std::memory_order_relaxed);
+      ++generation_;
+    }
+    wake_.notify_all();
+    Work();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return active_ == 0; });
+    job_ = nullptr;
+  }
+
+ private:
+  void WorkerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_) return;
+      seen = generation_;
+      // The loop may have already finished without this worker.
+      if (job_ == nullptr) continue;
+      ++active_;
+      lock.unlock();
+      Work();
+      lock.lock();
+      if (--active_ == 0) done_.notify_one();
+    }
+  }
+
+  // job_ and blocks_ can't change until the caller and every active worker
+  // are done with them.
+  void Work() {
+    in_block_ = true;
+    for (int32_t block = next_.fetch_add(1); block < blocks_;
+         block = next_.fetch_add(1)) {
+      (*job_)(block);
+    }
+    in_block_ = false;
+  }
+
+  inline static thread_local bool in_block_ = false;
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(int32_t)>* job_ = nullptr;
+  int32_t blocks_ = 0;
+  std::atomic<int32_t> next_{0};
+  int32_t active_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Golden traces for proving that an ECS change does not change the simulation.
+// A trace holds a hash of the live entity state after every system and a hash
+// of the draw output for every frame. Both hashes sort their input first, so
+// ECSs that store entities differently still produce the same trace.
+// EntityState, ToDraw and SystemObserver come from the ECS header.
+
+struct TraceEntry {
+  int32_t frame;
+  std::string system;
+  uint64_t hash;
+};
+
+// The inputs a trace was recorded with so it can be rerun exactly.
+struct TraceHeader {
+  uint64_t seed;
+  int32_t max_entities;
+  float spawn_rate;
+  int32_t frames;
+  // v1 traces predate these and ran with them off.
+  bool particle_bursts = false;
+  bool lazy_motion = false;
+  bool collisions = false;
+};
+
+inline uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Hashes the items as a multiset. T must not contain padding.
+template <typename T>
+uint64_t hash_sorted(std::vector<T> &items) {
+  std::sort(items.begin(), items.end(), [](const T &a, const T &b) {
+    return std::memcmp(&a, &b, sizeof(T)) < 0;
+  });
+  return fnv1a(0xcbf29ce484222325ull, items.data(), items.size() * sizeof(T));
+}
+
+template <typename ECS>
+class TraceRecorder : public SystemObserver {
+ public:
+  explicit TraceRecorder(const ECS &ecs) : ecs_(ecs) {}
+
+  void set_frame(int32_t frame) { frame_ = frame; }
+
+  void AfterSystem(const char *system) override {
+    states_.clear();
+    ecs_.ForEachLiveEntity(
+        [this](const EntityState &state) { states_.push_back(state); });
+    entries_.push_back({frame_, system, hash_sorted(states_)});
+  }
+
+  template <typename List>
+  void RecordDraw(const List &particles) {
+    std::vector<ToDraw> sorted(particles.begin(), particles.end());
+    entries_.push_back({frame_, "Draw", hash_sorted(sorted)});
+  }
+
+  const std::vector<TraceEntry> &entries() const { return entries_; }
+
+ private:
+  const ECS &ecs_;
+  int32_t frame_ = 0;
+  std::vector<EntityState> states_;
+  std::vector<TraceEntry> entries_;
+};
+
+inline bool write_trace(const std::string &path, const TraceHeader &header,
+                        const std::vector<TraceEntry> &entries) {
+  std::ofstream out(path);
+  if (!out) return false;
+  char spawn_rate[32];
+  std::snprintf(spawn_rate, sizeof(spawn_rate), "%a", header.spawn_rate);
+  out << "# ecs-trace v2\n"
+      << "seed " << header.seed << '\n'
+      << "max_entities " << header.max_entities << '\n'
+      << "spawn_rate " << spawn_rate << '\n'
+      << "frames " << header.frames << '\n'
+      << "particle_bursts " << header.particle_bursts << '\n'
+      << "lazy_motion " << header.lazy_motion << '\n'
+      << "collisions " << header.collisions << '\n';
+  for (const TraceEntry &entry : entries) {
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx",
+                  static_cast<unsigned long long>(entry.hash));
+    out << entry.frame << ' ' << entry.system << ' ' << hash << '\n';
+  }
+  return static_cast<bool>(out);
+}
+
+inline bool read_trace(const std::string &path, TraceHeader &header,
+                       std::vector<TraceEntry> &entries) {
+  std::ifstream in(path);
+  std::string line;
+  if (!std::getline(in, line) ||
+      (line != "# ecs-trace v1" && line != "# ecs-trace v2")) {
+    return false;
+  }
+  header.particle_bursts = false;
+  header.lazy_motion = false;
+  header.collisions = false;
+  const int keys = line == "# ecs-trace v1" ? 4 : 7;
+  std::string key, value;
+  for (int i = 0; i < keys; ++i) {
+    if (!(in >> key >> value)) return false;
+    if (key == "seed") {
+      header.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (key == "max_entities") {
+      header.max_entities = std::atoi(value.c_str());
+    } else if (key == "spawn_rate") {
+      header.spawn_rate = std::strtof(value.c_str(), nullptr);
+    } else if (key == "frames") {
+      header.frames = std::atoi(value.c_str());
+    } else if (key == "particle_bursts") {
+      header.particle_bursts = value == "1";
+    } else if (key == "lazy_motion") {
+      header.lazy_motion = value == "1";
+    } else if (key == "collisions") {
+      header.collisions = value == "1";
+    } else {
+      return false;
+    }
+  }
+  TraceEntry entry;
+  std::string hash;
+  while (in >> entry.frame >> entry.system >> hash) {
+    entry.hash = std::strtoull(hash.c_str(), nullptr, 16);
+    entries.push_back(entry);
+  }
+  return in.eof();
+}
+
+// Where a checked trace first disagrees with its golden trace.
+struct TraceDivergence {
+  int32_t frame;
+  std::string system;
+  // Empty when the system only ran in the other trace.
+  std::optional<uint64_t> expected;
+  std::optional<uint64_t> actual;
+};
+
+// Returns the first frame and system where actual disagrees with golden. A
+// system that only one of the traces ran disagrees too, unless it left the
+// live entities as the system before it did, so ECSs with extra bookkeeping
+// systems like the simple ECS's Refresh can be compared.
+inline std::optional<TraceDivergence> first_divergence(
+    const std::vector<TraceEntry> &golden,
+    const std::vector<TraceEntry> &actual) {
+  using Hashes = std::map<std::pair<int32_t, std::string>, uint64_t>;
+  auto index = [](const std::vector<TraceEntry> &trace) {
+    Hashes hashes;
+    for (const TraceEntry &entry : trace) {
+      hashes[{entry.frame, entry.system}] = entry.hash;
+    }
+    return hashes;
+  };
+  const Hashes golden_hashes = index(golden);
+  const Hashes actual_hashes = index(actual);
+  // The first entry of trace that other doesn't have the same hash for.
+  auto first_mismatch = [](const std::vector<TraceEntry> &trace,
+                           const Hashes &other) -> const TraceEntry * {
+    for (size_t i = 0; i < trace.size(); ++i) {
+      const TraceEntry &entry = trace[i];
+      auto it = other.find({entry.frame, entry.system});
+      const bool agrees =
+          it != other.end()
+              ? it->second == entry.hash
+              // Only bookkeeping, since the live entities didn't change.
+              : i > 0 && trace[i - 1].frame == entry.frame &&
+                    trace[i - 1].hash == entry.hash;
+      if (!agrees) return &entry;
+    }
+    return nullptr;
+  };
+  const TraceEntry *got = first_mismatch(actual, golden_hashes);
+  const TraceEntry *want = first_mismatch(golden, actual_hashes);
+  if (got == nullptr && want == nullptr) return std::nullopt;
+  // Whichever trace disagrees in an earlier frame.
+  const TraceEntry &entry =
+      got == nullptr || (want != nullptr && want->frame < got->frame) ? *want
+                                                                      : *got;
+  auto find = [&](const Hashes &hashes) -> std::optional<uint64_t> {
+    auto it = hashes.find({entry.frame, entry.system});
+    if (it == hashes.end()) return std::nullopt;
+    return it->second;
+  };
+  return TraceDivergence{.frame = entry.frame,
+                         .system = entry.system,
+                         .expected = find(golden_hashes),
+                         .actual = find(actual_hashes)};
+}
@@ -2,7 +2,7 @@ platform "roc-ecs-test"
     requires { Model } { main : Effect {} }
     exposes []
     packages {}
-    imports [ Program.{ ToDraw } ]
+    imports [ Program.{ ToDraw, Kinematics } ]
     provides [ mainForHost ]
 
 mainForHost :
@@ -10,6 +10,8 @@ mainForHost :
         initFn: (U32, I32 -> Box Model) as InitFn,
         setMaxFn: (Box Model, I32 -> Box Model) as SetMaxFn,
         sizeFn: (Box Model -> { model: Box Model, size: I32 }) as SizeFn,
-        stepFn: (Box Model, I32, F32, I32 -> { model: Box Model, toDraw: List ToDraw }) as StepFn,
+        stepFn: (Box Model, I32, F32, I32, List U32 -> { model: Box Model, toDraw: List ToDraw, randomUsed: I32 }) as StepFn,
+        beginStepFn: (Box Model, I32, List U32 -> { model: Box Model, kinematics: Kinematics }) as BeginStepFn,
+        endStepFn: (Box Model, Kinematics, I32, F32, I32 -> { model: Box Model, toDraw: List ToDraw, randomUsed: I32 }) as EndStepFn,
     }
 mainForHost = main
\ No newline at end of file
@@ -1,6 +1,6 @@
 interface Program
     exposes [ Program ]
-    imports []
+    imports [ Signiture.{ Signiture } ]
 
 # Names are weird here cause we need to match SDL ordering.
 Color : {
@@ -17,10 +17,61 @@ ToDraw : {
     y: F32,
 }
 
+# The components the host's kernels work on live here so their layout is
+# part of the platform. roc-ecs-platform.h mirrors them.
+Entity : {
+    id: I32,
+    signiture: Signiture,
+}
+
+CompFade : {
+    rRate: U8,
+    rMin: U8,
+    gRate: U8,
+    gMin: U8,
+    bRate: U8,
+    bMin: U8,
+    aRate: U8,
+    aMin: U8,
+}
+
+CompGraphic : {
+    color: Color,
+    radius: F32,
+}
+
+CompPosition : {
+    x: F32,
+    y: F32,
+}
+
+CompVelocity : {
+    dx: F32,
+    dy: F32,
+}
+
+# What Fade, Move and Gravity read and write, lent to the host between
+# beginStepFn and endStepFn.
+Kinematics : {
+    size: I32,
+    entities: List Entity,
+    fades: List CompFade,
+    graphics: List CompGraphic,
+    positions: List CompPosition,
+    velocities: List CompVelocity,
+}
+
 Program model :
     {
         initFn: U32, I32 -> Box model,
         setMaxFn: Box model, I32 -> Box model,
         sizeFn: Box model -> { model: Box model, size: I32 },
-        stepFn: Box model, I32, F32, I32 -> { model: Box model, toDraw: List ToDraw },
+        # The List U32 is random values from the host's generator for this
+        # frame. randomUsed is how many the frame wanted, which may be more
+        # than it was given.
+        stepFn: Box model, I32, F32, I32, List U32 -> { model: Box model, toDraw: List ToDraw, randomUsed: I32 },
+        # The same step split around Fade, Move and Gravity, which the host
+        # runs natively on the Kinematics in between.
+        beginStepFn: Box model, I32, List U32 -> { model: Box model, kinematics: Kinematics },
+        endStepFn: Box model, Kinematics, I32, F32, I32 -> { model: Box model, toDraw: List ToDraw, randomUsed: I32 },
     }
\ No newline at end of file
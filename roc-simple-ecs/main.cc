@@ -85,6 +85,8 @@ int main() {
   ECS ecs(max_entities);
   int32_t frames = 0, current_frame = 0;
   int32_t entity_count = 0;
+  // Time spent in Roc, which is what the host's random pool is meant to cut.
+  double step_ms = 0.0;
   float spawn_rate = 1.0f / 15.0f;
   bool render = true;
   Uint32 last_print = SDL_GetTicks();
@@ -118,13 +120,20 @@ int main() {
           case SDLK_x:
             render = !render;
             break;
+          case SDLK_h:
+            ecs.SetHybrid(!ecs.hybrid());
+            std::cout << "Hybrid: " << (ecs.hybrid() ? "on" : "off") << '\n';
+            break;
           default:
             break;
         }
       }
     }
     SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
+    Uint64 step_start = SDL_GetPerformanceCounter();
     auto particles = ecs.Step(current_frame, spawn_rate, 16);
+    step_ms += (SDL_GetPerformanceCounter() - step_start) /
+               (double)SDL_GetPerformanceFrequency() * 1000.0;
     // std::cout << "size: " << particles.size() << '\n';
     if (render) {
       void *pixels = nullptr;
@@ -147,8 +156,10 @@ int main() {
 
     if (SDL_GetTicks() - last_print > 1000) {
       std::cout << "Current FPS: " << std::to_string(frames) << "\t\t";
-      std::cout << "Max Entities: " << std::to_string(entity_count) << '\n';
+      std::cout << "Max Entities: " << std::to_string(entity_count) << "\t\t";
+      std::cout << "Step/Frame: " << step_ms / frames << "ms\n";
       entity_count = 0;
+      step_ms = 0.0;
       frames = 0;
       last_print = SDL_GetTicks();
     }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <random>
@@ -61,6 +62,14 @@ template <typename T>
 class RocList {
  public:
   RocList() {}
+  // A new list with one reference, to be filled and handed to Roc.
+  explicit RocList(size_t size) : size_(size) {
+    if (size_ == 0) return;
+    ssize_t* rc = static_cast<ssize_t*>(
+        roc_alloc(sizeof(ssize_t) + size * sizeof(T), alignof(ssize_t)));
+    *rc = std::numeric_limits<ssize_t>::min();
+    elements_ = reinterpret_cast<T*>(rc + 1);
+  }
   RocList(RocList&& old) {
     elements_ = old.elements_;
     size_ = old.size_;
@@ -89,6 +98,31 @@ class RocList {
 
   size_t size() { return size_; }
 
+  // Whether Roc holds no other reference, so the elements can be changed in
+  // place. Constant lists have a refcount of 0 and are never unique.
+  bool unique() const {
+    return size_ == 0 ||
+           *refcount_ptr() == std::numeric_limits<ssize_t>::min();
+  }
+
+  // Copies the elements into a list of their own if Roc shares them and
+  // drops this reference to the shared one, which is what List.set does.
+  void MakeUnique() {
+    if (unique()) return;
+    RocList copy(size_);
+    std::copy(begin(), end(), copy.begin());
+    ssize_t* rc = refcount_ptr();
+    if (*rc < 0) *rc -= 1;
+    elements_ = copy.elements_;
+    copy.Release();
+  }
+
+  // Passing a list to Roc passes its reference too, so Roc frees it.
+  void Release() {
+    elements_ = nullptr;
+    size_ = 0;
+  }
+
  private:
   ssize_t* refcount_ptr() const {
     return reinterpret_cast<ssize_t*>(elements_) - 1;
@@ -98,11 +132,129 @@ class RocList {
   size_t size_ = 0;
 };
 
+// Components from Program.roc, with fields in the order Roc lays them out:
+// by alignment, then by name.
+struct Entity {
+  int32_t id;
+  uint8_t signiture;
+};
+
+struct CompFade {
+  uint8_t a_min;
+  uint8_t a_rate;
+  uint8_t b_min;
+  uint8_t b_rate;
+  uint8_t g_min;
+  uint8_t g_rate;
+  uint8_t r_min;
+  uint8_t r_rate;
+};
+
+struct CompGraphic {
+  float radius;
+  Color color;
+};
+
+struct CompPosition {
+  float x;
+  float y;
+};
+
+struct CompVelocity {
+  float dx;
+  float dy;
+};
+
+// Signiture.roc's bits.
+enum SignitureBit : uint8_t {
+  FEELS_GRAVITY = 1 << 0,
+  DEATH_TIME = 1 << 1,
+  FADE = 1 << 2,
+  EXPLODE = 1 << 3,
+  GRAPHIC = 1 << 4,
+  POSITION = 1 << 5,
+  VELOCITY = 1 << 6,
+  ALIVE = 1 << 7,
+};
+
+// The columns Roc lends the host between BeginStepFn and EndStepFn.
+struct Kinematics {
+  RocList<Entity> entities;
+  RocList<CompFade> fades;
+  RocList<CompGraphic> graphics;
+  RocList<CompPosition> positions;
+  RocList<CompVelocity> velocities;
+  int32_t size;
+
+  // Handing them back passes their references back to Roc too.
+  void Release() {
+    entities.Release();
+    fades.Release();
+    graphics.Release();
+    positions.Release();
+    velocities.Release();
+  }
+};
+
+inline bool matches(uint8_t signiture, uint8_t required) {
+  return (signiture & required) == required;
+}
+
+inline uint8_t fade_channel(uint8_t value, uint8_t rate, uint8_t min) {
+  return std::max<int>(min, value - rate);
+}
+
+// The Fade, Move and Gravity systems of simpleEcs.roc as plain loops over
+// the lent columns, doing exactly what the Roc versions do. Only the
+// columns that are written have to be unique.
+inline void run_kinematics(Kinematics& k) {
+  k.graphics.MakeUnique();
+  k.positions.MakeUnique();
+  k.velocities.MakeUnique();
+  const Entity* entities = k.entities.begin();
+  const CompFade* fades = k.fades.begin();
+  CompGraphic* graphics = k.graphics.begin();
+  CompPosition* positions = k.positions.begin();
+  CompVelocity* velocities = k.velocities.begin();
+  const int32_t size = std::min<size_t>(k.size, k.entities.size());
+
+  for (int32_t i = 0; i < size; ++i) {
+    const Entity& e = entities[i];
+    if (matches(e.signiture, ALIVE | FADE | GRAPHIC)) {
+      const CompFade& fade = fades[e.id];
+      Color& color = graphics[e.id].color;
+      color.r = fade_channel(color.r, fade.r_rate, fade.r_min);
+      color.g = fade_channel(color.g, fade.g_rate, fade.g_min);
+      color.b = fade_channel(color.b, fade.b_rate, fade.b_min);
+      color.a = fade_channel(color.a, fade.a_rate, fade.a_min);
+    }
+  }
+  for (int32_t i = 0; i < size; ++i) {
+    const Entity& e = entities[i];
+    if (matches(e.signiture, ALIVE | POSITION | VELOCITY)) {
+      positions[e.id].x += velocities[e.id].dx;
+      positions[e.id].y += velocities[e.id].dy;
+    }
+  }
+  for (int32_t i = 0; i < size; ++i) {
+    const Entity& e = entities[i];
+    if (matches(e.signiture, ALIVE | FEELS_GRAVITY | VELOCITY)) {
+      velocities[e.id].dy -= 0.0003f;
+    }
+  }
+}
+
 using RocModel = void*;
 
 struct StepReturn {
   RocModel model;
   RocList<ToDraw> to_draw;
+  int32_t random_used;
+};
+
+struct BeginStepReturn {
+  Kinematics kinematics;
+  RocModel model;
 };
 
 struct SizeReturn {
@@ -120,13 +272,48 @@ void roc__mainForHost_1_SizeFn_caller(RocModel& model, void* capture,
 void roc__mainForHost_1_StepFn_caller(RocModel& model, int32_t& current_frame,
                                       float& spawn_rate,
                                       int32_t& explosion_particles,
+                                      RocList<uint32_t>& random_pool,
                                       void* capture, StepReturn& ret);
+void roc__mainForHost_1_BeginStepFn_caller(RocModel& model,
+                                           int32_t& current_frame,
+                                           RocList<uint32_t>& random_pool,
+                                           void* capture,
+                                           BeginStepReturn& ret);
+void roc__mainForHost_1_EndStepFn_caller(RocModel& model,
+                                         Kinematics& kinematics,
+                                         int32_t& current_frame,
+                                         float& spawn_rate,
+                                         int32_t& explosion_particles,
+                                         void* capture, StepReturn& ret);
 }
 
+// pcg32 (XSH RR 64/32), as in pcg-random.org's minimal C implementation.
+class Pcg32 {
+ public:
+  Pcg32(uint64_t seed, uint64_t stream) : state_(0), inc_((stream << 1) | 1) {
+    Next();
+    state_ += seed;
+    Next();
+  }
+
+  uint32_t Next() {
+    uint64_t old = state_;
+    state_ = old * 6364136223846793005ULL + inc_;
+    uint32_t xorshifted = ((old >> 18u) ^ old) >> 27u;
+    uint32_t rot = old >> 59u;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+
+ private:
+  uint64_t state_;
+  uint64_t inc_;
+};
+
 class ECS {
  public:
-  explicit ECS(int32_t max) {
-    uint32_t seed = std::random_device{}();
+  explicit ECS(int32_t max) : ECS(max, std::random_device{}()) {}
+
+  ECS(int32_t max, uint32_t seed) : rng_(seed, 0xda3e39cb94b95bdbULL) {
     roc__mainForHost_1_InitFn_caller(seed, max, nullptr, model_);
   }
 
@@ -137,13 +324,46 @@ class ECS {
 
   RocList<ToDraw> Step(int32_t current_frame, float spawn_rate,
                        int32_t explosion_particles) {
+    // Stepping a pcg32 in C++ is far cheaper than threading Random.State
+    // through Roc one value at a time, so every random value the frame
+    // needs is made here in one go. Roc falls back to its own generator if
+    // it needs more than this, and says how many it wanted.
+    RocList<uint32_t> random_pool(random_pool_size_);
+    for (uint32_t& value : random_pool) value = rng_.Next();
     StepReturn ret;
-    roc__mainForHost_1_StepFn_caller(model_, current_frame, spawn_rate,
-                                     explosion_particles, nullptr, ret);
+    if (hybrid_) {
+      BeginStepReturn begin;
+      roc__mainForHost_1_BeginStepFn_caller(model_, current_frame,
+                                            random_pool, nullptr, begin);
+      random_pool.Release();
+      run_kinematics(begin.kinematics);
+      roc__mainForHost_1_EndStepFn_caller(
+          begin.model, begin.kinematics, current_frame, spawn_rate,
+          explosion_particles, nullptr, ret);
+      begin.kinematics.Release();
+    } else {
+      roc__mainForHost_1_StepFn_caller(model_, current_frame, spawn_rate,
+                                       explosion_particles, random_pool,
+                                       nullptr, ret);
+      random_pool.Release();
+    }
     model_ = ret.model;
+    // Explosions come in bursts, so the pool follows the most recent frames
+    // wanted and only shrinks slowly after one.
+    random_used_peak_ =
+        std::max(static_cast<size_t>(ret.random_used),
+                 random_used_peak_ - random_used_peak_ / 16);
+    random_pool_size_ =
+        std::max(MIN_RANDOM_POOL, random_used_peak_ + random_used_peak_ / 2);
     return std::move(ret.to_draw);
   }
 
+  // With hybrid stepping Fade, Move and Gravity run as native loops over
+  // the columns between two halves of the Roc step. The rest of the game
+  // stays in Roc either way.
+  void SetHybrid(bool hybrid) { hybrid_ = hybrid; }
+  bool hybrid() const { return hybrid_; }
+
   int32_t size() {
     SizeReturn ret;
     roc__mainForHost_1_SizeFn_caller(model_, nullptr, ret);
@@ -152,5 +372,12 @@ class ECS {
   }
 
  private:
+  // Enough for a few fireworks, so quiet frames don't keep shrinking it.
+  static constexpr size_t MIN_RANDOM_POOL = 64;
+
   RocModel model_;
+  Pcg32 rng_;
+  size_t random_pool_size_ = MIN_RANDOM_POOL;
+  size_t random_used_peak_ = 0;
+  bool hybrid_ = false;
 };
\ No newline at end of file
@@ -1,6 +1,6 @@
 app "roc-simple-ecs"
     packages { pf: "." }
-    imports [ pf.Program.{ Program, Color, ToDraw }, Random, Signiture.{ Signiture } ]
+    imports [ pf.Program.{ Program, Color, ToDraw, Entity, CompFade, CompGraphic, CompPosition, CompVelocity, Kinematics }, Random, Signiture.{ Signiture } ]
     provides [ main ] { Model } to pf
 
 main: Program Model
@@ -9,6 +9,8 @@ main = {
         setMaxFn,
         sizeFn,
         stepFn,
+        beginStepFn,
+        endStepFn,
     }
 
 pi : F32
@@ -16,45 +18,14 @@ pi = Num.acos -1
 twoPi : F32
 twoPi = 2.0 * pi
 
-Entity : {
-    id: I32,
-    signiture: Signiture,
-}
-
 CompDeathTime : {
     deadFrame: I32,
 }
 
-CompFade : {
-    rRate: U8,
-    rMin: U8,
-    gRate: U8,
-    gMin: U8,
-    bRate: U8,
-    bMin: U8,
-    aRate: U8,
-    aMin: U8,
-}
-
 CompExplode : {
     numParticles: I32
 }
 
-CompGraphic : {
-    color: Color,
-    radius: F32,
-}
-
-CompPosition : {
-    x: F32,
-    y: F32,
-}
-
-CompVelocity : {
-    dx: F32,
-    dy: F32,
-}
-
 genEntities : Nat -> List Entity
 genEntities = \count ->
     base = List.repeat {id: 0, signiture: Signiture.empty} count
@@ -70,7 +41,11 @@ genEntitiesHelper = \entities, index ->
             entities
 
 Model : {
+    # Only used once randomPool runs out.
     rng: Random.State U32,
+    # Random values from the host for this frame and the next one to use.
+    randomPool: List U32,
+    randomNext: Nat,
     max: I32,
     size: I32,
     nextSize: I32,
@@ -88,6 +63,8 @@ initFn = \seed, max ->
     maxNat = Num.toNat max
     Box.box {
         rng: Random.seed32 seed,
+        randomPool: [],
+        randomNext: 0,
         max,
         size: 0,
         nextSize: 0,
@@ -122,18 +99,42 @@ sizeFn = \boxModel ->
     model = Box.unbox boxModel
     { model: boxModel, size: model.size }
 
-stepFn : Box Model, I32, F32, I32 -> { model: Box Model, toDraw: List ToDraw }
-stepFn = \boxModel, currentFrame, spawnRate, particles ->
+stepFn : Box Model, I32, F32, I32, List U32 -> { model: Box Model, toDraw: List ToDraw, randomUsed: I32 }
+stepFn = \boxModel, currentFrame, spawnRate, particles, randomPool ->
+    model0 = startStep (Box.unbox boxModel) currentFrame randomPool
+    model1 = fadeSystem model0
+    model2 = moveSystem model1
+    model3 = gravitySystem model2
+    finishStep model3 currentFrame spawnRate particles
+
+# The hybrid step. The columns are moved out of the model so the host gets
+# the only reference to them and can change them in place.
+beginStepFn : Box Model, I32, List U32 -> { model: Box Model, kinematics: Kinematics }
+beginStepFn = \boxModel, currentFrame, randomPool ->
+    model0 = startStep (Box.unbox boxModel) currentFrame randomPool
+    {size, entities, fades, graphics, positions, velocities} = model0
+    model1 = { model0 & entities: [], fades: [], graphics: [], positions: [], velocities: [] }
+    { model: Box.box model1, kinematics: { size, entities, fades, graphics, positions, velocities } }
+
+endStepFn : Box Model, Kinematics, I32, F32, I32 -> { model: Box Model, toDraw: List ToDraw, randomUsed: I32 }
+endStepFn = \boxModel, kinematics, currentFrame, spawnRate, particles ->
     model0 = Box.unbox boxModel
+    {entities, fades, graphics, positions, velocities} = kinematics
+    model1 = { model0 & entities, fades, graphics, positions, velocities }
+    finishStep model1 currentFrame spawnRate particles
+
+startStep : Model, I32, List U32 -> Model
+startStep = \model, currentFrame, randomPool ->
+    model0 = { model & randomPool, randomNext: 0 }
     model1 = deathSystem model0 currentFrame
-    model2 = explodeSystem model1 currentFrame
-    model3 = fadeSystem model2
-    model4 = moveSystem model3
-    model5 = gravitySystem model4
-    model6 = spawnSystem model5 currentFrame spawnRate particles
-    model7 = refresh model6
-    toDraw = graphicsSystem model7
-    {model: Box.box model7, toDraw}
+    explodeSystem model1 currentFrame
+
+finishStep : Model, I32, F32, I32 -> { model: Box Model, toDraw: List ToDraw, randomUsed: I32 }
+finishStep = \model0, currentFrame, spawnRate, particles ->
+    model1 = spawnSystem model0 currentFrame spawnRate particles
+    model2 = refresh model1
+    toDraw = graphicsSystem model2
+    {model: Box.box model2, toDraw, randomUsed: Num.toI32 model2.randomNext}
 
 refresh : Model -> Model
 refresh = \model ->
@@ -209,6 +210,21 @@ numRoundU32 = \x -> Num.toU32 (Num.round x)
 numRoundU8 : F32 -> U8
 numRoundU8 = \x -> Num.toU8 (Num.round x)
 
+# Draws a U32 between min and max (inclusive) from the values the host
+# generated for this frame, which is a list lookup instead of a generator
+# step. Once they run out it falls back to the model's own generator, so a
+# frame that needs more than the host guessed still gets them.
+random : Model, U32, U32 -> { model: Model, value: U32 }
+random = \model, min, max ->
+    next = model.randomNext
+    when List.get model.randomPool next is
+        Ok raw ->
+            value = min + (raw % (max - min + 1) |> Result.withDefault 0)
+            { model: { model & randomNext: next + 1 }, value }
+        Err OutOfBounds ->
+            generation = (Random.u32 min max) model.rng
+            { model: { model & rng: generation.state, randomNext: next + 1 }, value: generation.value }
+
 spawnFirework : Model, I32, I32 -> Result Model [ OutOfSpace Model ]
 spawnFirework = \model0, currentFrame, numParticles ->
     signiture =
@@ -221,18 +237,17 @@ spawnFirework = \model0, currentFrame, numParticles ->
         |> Signiture.setVelocity
     when addEntity model0 signiture is
         Ok result ->
-            model1 = result.model
             # All rand mapped so that 0.0 to 1.0 is 0 to 1,000,000
-            riseSpeedRand = (Random.u32 10_000 25_000) model1.rng
+            riseSpeedRand = random result.model 10_000 25_000
             riseSpeed = (Num.toFloat riseSpeedRand.value) / 1_000_000.0
             framesToCrossScreen = 1.0 / riseSpeed
             lifeMin = numRoundU32 (framesToCrossScreen * 0.6 * 1_000_000.0)
             lifeMax = numRoundU32 (framesToCrossScreen * 0.95 * 1_000_000.0)
-            lifeInFramesRand = (Random.u32 lifeMin lifeMax) riseSpeedRand.state
+            lifeInFramesRand = random riseSpeedRand.model lifeMin lifeMax
             lifeInFrames = (Num.toFloat lifeInFramesRand.value) / 1_000_000.0
             deadFrame = currentFrame + (numRoundI32 lifeInFrames)
 
-            colorRand = (Random.u32 0 2) lifeInFramesRand.state
+            colorRand = random lifeInFramesRand.model 0 2
             color: Color
             color =
                 when colorRand.value is
@@ -241,8 +256,9 @@ spawnFirework = \model0, currentFrame, numParticles ->
                     2 -> { aB: 0, bG: 0, cR: 255, dA: 255}
                     _ -> { aB: 0-1, bG: 0, cR: 0, dA: 255} # This should be impossible
 
-            xRand = (Random.u32 50_000 950_000) colorRand.state
+            xRand = random colorRand.model 50_000 950_000
             x = (Num.toFloat xRand.value) / 1_000_000.0
+            model1 = xRand.model
             id = Num.toNat result.id
             {deathTimes, explodes, graphics, positions, velocities} = model1
             model2 =
@@ -256,7 +272,6 @@ spawnFirework = \model0, currentFrame, numParticles ->
                 }
             Ok {
                 model2 &
-                rng: xRand.state,
                 deathTimes: List.set deathTimes id { deadFrame },
                 explodes: List.set explodes id { numParticles },
                 graphics: List.set graphics id { color, radius: 0.02 },
@@ -280,8 +295,8 @@ spawnSystemHelper = \model0, currentFrame, spawnRate, numParticles  ->
                 model1
     else
         spawnRateU32 = numRoundU32 (spawnRate * 1_000_000.0)
-        spawnRand = (Random.u32 0 1_000_000) model0.rng
-        model1 = { model0 & rng: spawnRand.state }
+        spawnRand = random model0 0 1_000_000
+        model1 = spawnRand.model
         if spawnRand.value < spawnRateU32 then
             when spawnFirework model1 currentFrame numParticles is
                 Ok model2 -> model2
@@ -371,8 +386,8 @@ spawnExplosion = \model0, pos, oldColor, numParticles, currentFrame ->
         |> Signiture.setPosition
     when addEntity model0 signiture is
         Ok result ->
-            model1 = result.model
-            lifeInFramesRand = (Random.u32 10 30) model1.rng
+            lifeInFramesRand = random result.model 10 30
+            model1 = lifeInFramesRand.model
             lifeInFrames = lifeInFramesRand.value
             frameScale = 10.0 / (Num.toFloat lifeInFrames)
             deadFrame = currentFrame + Num.toI32 lifeInFrames
@@ -471,10 +486,9 @@ spawnParticles = \model0, i, particles, pos, fade, color, currentFrame, lifeInFr
     if i < particles then
         when addEntity model0 particleSigniture is
             Ok result ->
-                model1 = result.model
                 minDir = numRoundU32 (1_000_000.0 * chunkSize * Num.toFloat i)
                 maxDir = numRoundU32 (1_000_000.0 * chunkSize * Num.toFloat (i + 1))
-                dirRand = (Random.u32 minDir maxDir) model1.rng
+                dirRand = random result.model minDir maxDir
                 dir = (Num.toFloat dirRand.value) / 1_000_000.0
                 unitDx = cosApprox dir
                 unitDy = sinApprox dir
@@ -482,7 +496,8 @@ spawnParticles = \model0, i, particles, pos, fade, color, currentFrame, lifeInFr
                 dx = unitDx * velScale
                 dy = unitDy * velScale
 
-                lifeBonusRand = (Random.u32 0 10) dirRand.state
+                lifeBonusRand = random dirRand.model 0 10
+                model1 = lifeBonusRand.model
                 deadFrame = currentFrame + (numRoundI32 (1.5 * Num.toFloat lifeInFrames)) + Num.toI32 lifeBonusRand.value
 
                 id = Num.toNat result.id
@@ -497,7 +512,6 @@ spawnParticles = \model0, i, particles, pos, fade, color, currentFrame, lifeInFr
                     }
                 model3 = {
                         model2 &
-                        rng: lifeBonusRand.state,
                         deathTimes: List.set deathTimes id { deadFrame },
                         fades: List.set fades id fade,
                         graphics: List.set graphics id { color, radius: 0.015 / frameScale },